@@ -11,6 +11,8 @@
 #include <linux/mfd/rsmu.h>
 
 #define RSMU_CM_SCSR_BASE		0x20100000
+/* Never matches a real page, forces the next access to select one */
+#define RSMU_PAGE_UNKNOWN		0xFFFFFFFF
 
 int rsmu_core_init(struct rsmu_ddata *rsmu);
 void rsmu_core_exit(struct rsmu_ddata *rsmu);
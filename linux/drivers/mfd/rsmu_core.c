@@ -49,6 +49,153 @@ static struct mfd_cell rsmu_fc3_devs[] = {
 	},
 };
 
+static u16 rsmu_txn_max_len(bool read)
+{
+	return read ? RSMU_MAX_READ_COUNT : RSMU_MAX_WRITE_COUNT;
+}
+
+static int rsmu_txn_insert(struct rsmu_txn *txn, u32 addr, u8 *buf, u16 len,
+			   bool read)
+{
+	u32 page_mask = txn->rsmu->page_mask;
+	u32 page = addr & page_mask;
+	struct rsmu_txn_op *prev;
+	u16 pos, offset, i;
+
+	if (txn->n_ops == RSMU_TXN_MAX_OPS ||
+	    (read && txn->n_dst == RSMU_TXN_MAX_OPS) ||
+	    txn->data_len + len > RSMU_TXN_MAX_DATA)
+		return -ENOSPC;
+
+	/* Sort by page after the last barrier, keeping queue order per page */
+	for (pos = txn->seg_start; pos < txn->n_ops; pos++)
+		if ((txn->ops[pos].addr & page_mask) > page)
+			break;
+
+	offset = pos < txn->n_ops ? txn->ops[pos].offset : txn->data_len;
+
+	/* Data is kept in op order so that merged ops stay contiguous */
+	memmove(&txn->data[offset + len], &txn->data[offset],
+		txn->data_len - offset);
+	txn->data_len += len;
+
+	for (i = pos; i < txn->n_ops; i++)
+		txn->ops[i].offset += len;
+
+	for (i = 0; i < txn->n_dst; i++)
+		if (txn->dst[i].offset >= offset)
+			txn->dst[i].offset += len;
+
+	if (read) {
+		txn->dst[txn->n_dst].buf = buf;
+		txn->dst[txn->n_dst].offset = offset;
+		txn->dst[txn->n_dst].len = len;
+		txn->n_dst++;
+	} else {
+		memcpy(&txn->data[offset], buf, len);
+	}
+
+	prev = pos > txn->seg_start ? &txn->ops[pos - 1] : NULL;
+
+	if (prev && prev->read == read && prev->addr + prev->len == addr &&
+	    (prev->addr & page_mask) == page &&
+	    prev->len + len <= rsmu_txn_max_len(read)) {
+		prev->len += len;
+		return 0;
+	}
+
+	memmove(&txn->ops[pos + 1], &txn->ops[pos],
+		(txn->n_ops - pos) * sizeof(txn->ops[0]));
+
+	txn->ops[pos].addr = addr;
+	txn->ops[pos].len = len;
+	txn->ops[pos].offset = offset;
+	txn->ops[pos].read = read;
+	txn->n_ops++;
+
+	return 0;
+}
+
+static int rsmu_core_txn_queue(struct rsmu_txn *txn, u32 addr, u8 *buf,
+			       u16 len, bool read)
+{
+	u32 page_mask = txn->rsmu->page_mask;
+	u16 chunk;
+	int err;
+
+	if (txn->err)
+		return txn->err;
+
+	while (len) {
+		chunk = min_t(u16, len, rsmu_txn_max_len(read));
+
+		/* A single bus access never crosses a page */
+		if (page_mask)
+			chunk = min_t(u32, chunk,
+				      (addr | ~page_mask) - addr + 1);
+
+		err = rsmu_txn_insert(txn, addr, buf, chunk, read);
+		if (err) {
+			txn->err = err;
+			return err;
+		}
+
+		addr += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/* Used when the bus driver has no faster way to run a transaction */
+static int rsmu_txn_regmap_xfer(struct rsmu_ddata *rsmu, struct rsmu_txn *txn)
+{
+	struct rsmu_txn_op *op;
+	int err = 0;
+	u16 i;
+
+	for (i = 0; i < txn->n_ops && !err; i++) {
+		op = &txn->ops[i];
+
+		if (op->read)
+			err = regmap_bulk_read(rsmu->regmap, op->addr,
+					       &txn->data[op->offset], op->len);
+		else
+			err = regmap_bulk_write(rsmu->regmap, op->addr,
+						&txn->data[op->offset], op->len);
+	}
+
+	return err;
+}
+
+static int rsmu_core_txn_commit(struct rsmu_txn *txn)
+{
+	struct rsmu_ddata *rsmu = txn->rsmu;
+	int err = txn->err;
+	u16 i;
+
+	if (!err && txn->n_ops) {
+		if (rsmu->txn_xfer)
+			err = rsmu->txn_xfer(rsmu, txn);
+		else
+			err = rsmu_txn_regmap_xfer(rsmu, txn);
+	}
+
+	if (!err)
+		for (i = 0; i < txn->n_dst; i++)
+			memcpy(txn->dst[i].buf, &txn->data[txn->dst[i].offset],
+			       txn->dst[i].len);
+
+	txn->err = 0;
+	txn->n_ops = 0;
+	txn->n_dst = 0;
+	txn->seg_start = 0;
+	txn->data_len = 0;
+
+	return err;
+}
+
 int rsmu_core_init(struct rsmu_ddata *rsmu)
 {
 	struct mfd_cell *cells;
@@ -71,6 +218,9 @@ int rsmu_core_init(struct rsmu_ddata *rsmu)
 
 	mutex_init(&rsmu->lock);
 
+	rsmu->txn_queue = rsmu_core_txn_queue;
+	rsmu->txn_commit = rsmu_core_txn_commit;
+
 	ret = devm_mfd_add_devices(rsmu->dev, PLATFORM_DEVID_AUTO, cells,
 				   RSMU_N_DEVS, NULL, 0, NULL);
 	if (ret < 0)
@@ -233,6 +233,113 @@ static int rsmu_smbus_i2c_reg_write(void *context, unsigned int reg, unsigned in
 	return err;
 }
 
+/*
+ * Run a whole transaction as one combined i2c_transfer, with page selects
+ * only where the page changes. ClockMatrix and FemtoClock3 on a full I2C
+ * adapter without quirks only: Sabre pages are cached by regmap and must go
+ * through it.
+ */
+static int rsmu_i2c_txn_xfer(struct rsmu_ddata *rsmu, struct rsmu_txn *txn)
+{
+	struct i2c_client *client = to_i2c_client(rsmu->dev);
+	u32 page = rsmu->page;
+	struct rsmu_txn_op *op;
+	struct i2c_msg *msgs;
+	size_t tx_len = 0;
+	int n = 0, cnt;
+	u8 *tx, *p;
+	u16 i;
+
+	/* Worst case: a page select, a 2-byte address and the data per op */
+	for (i = 0; i < txn->n_ops; i++)
+		tx_len += 5 + 2 + (txn->ops[i].read ? 0 : txn->ops[i].len);
+
+	msgs = kcalloc(3 * txn->n_ops, sizeof(*msgs), GFP_KERNEL);
+	tx = kmalloc(tx_len, GFP_KERNEL);
+	if (!msgs || !tx) {
+		kfree(msgs);
+		kfree(tx);
+		return -ENOMEM;
+	}
+
+	p = tx;
+
+	for (i = 0; i < txn->n_ops; i++) {
+		op = &txn->ops[i];
+
+		if (rsmu->type == RSMU_CM && op->addr >= RSMU_CM_SCSR_BASE &&
+		    (op->addr & RSMU_CM_PAGE_MASK) != page) {
+			page = op->addr & RSMU_CM_PAGE_MASK;
+			p[0] = RSMU_CM_PAGE_ADDR;
+			p[1] = 0x0;
+			p[2] = (u8)((page >> 8) & 0xFF);
+			p[3] = (u8)((page >> 16) & 0xFF);
+			p[4] = (u8)((page >> 24) & 0xFF);
+
+			msgs[n].addr = client->addr;
+			msgs[n].flags = 0;
+			msgs[n].len = 5;
+			msgs[n].buf = p;
+			n++;
+			p += 5;
+		}
+
+		msgs[n].addr = client->addr;
+		msgs[n].flags = 0;
+		msgs[n].buf = p;
+
+		if (rsmu->type == RSMU_CM) {
+			*p++ = (u8)(op->addr & RSMU_CM_ADDRESS_MASK);
+		} else {
+			/* 16-bit big endian register address */
+			*p++ = (u8)(op->addr >> 8);
+			*p++ = (u8)op->addr;
+		}
+
+		if (op->read) {
+			msgs[n].len = p - msgs[n].buf;
+			n++;
+
+			msgs[n].addr = client->addr;
+			msgs[n].flags = I2C_M_RD;
+			msgs[n].len = op->len;
+			msgs[n].buf = &txn->data[op->offset];
+		} else {
+			memcpy(p, &txn->data[op->offset], op->len);
+			p += op->len;
+			msgs[n].len = p - msgs[n].buf;
+		}
+		n++;
+	}
+
+	cnt = i2c_transfer(client->adapter, msgs, n);
+
+	kfree(msgs);
+	kfree(tx);
+
+	if (cnt != n) {
+		/* Some page select may or may not have landed */
+		rsmu->page = RSMU_PAGE_UNKNOWN;
+		dev_err(rsmu->dev,
+			"i2c_transfer sent only %d of %d messages", cnt, n);
+		return cnt < 0 ? cnt : -EIO;
+	}
+
+	rsmu->page = page;
+
+	return 0;
+}
+
+/*
+ * A transaction can be up to 3 * RSMU_TXN_MAX_OPS messages of mixed lengths
+ * and directions, more than an adapter with quirks is likely to take in one
+ * i2c_transfer. Those are left to the regmap path, a message pair per op.
+ */
+static bool rsmu_i2c_can_txn(struct i2c_adapter *adapter)
+{
+	return i2c_check_functionality(adapter, I2C_FUNC_I2C) && !adapter->quirks;
+}
+
 static const struct regmap_config rsmu_i2c_cm_regmap_config = {
 	.reg_bits = 32,
 	.val_bits = 8,
@@ -289,8 +396,11 @@ static int rsmu_i2c_probe(struct i2c_client *client,
 
 	switch (rsmu->type) {
 	case RSMU_CM:
+		rsmu->page_mask = RSMU_CM_PAGE_MASK;
 		if (i2c_check_functionality(client->adapter, I2C_FUNC_I2C)) {
 			cfg = &rsmu_i2c_cm_regmap_config;
+			if (rsmu_i2c_can_txn(client->adapter))
+				rsmu->txn_xfer = rsmu_i2c_txn_xfer;
 		} else if (i2c_check_functionality(client->adapter,
 						   I2C_FUNC_SMBUS_I2C_BLOCK)) {
 			cfg = &rsmu_smbus_i2c_cm_regmap_config;
@@ -300,10 +410,13 @@ static int rsmu_i2c_probe(struct i2c_client *client,
 		}
 		break;
 	case RSMU_SABRE:
+		rsmu->page_mask = ~(RSMU_SABRE_PAGE_WINDOW - 1);
 		cfg = &rsmu_sabre_regmap_config;
 		break;
 	case RSMU_FC3:
 		cfg = &rsmu_fc3_regmap_config;
+		if (rsmu_i2c_can_txn(client->adapter))
+			rsmu->txn_xfer = rsmu_i2c_txn_xfer;
 		break;
 	default:
 		dev_err(rsmu->dev, "Unsupported RSMU device type: %d\n", rsmu->type);
@@ -90,48 +90,62 @@ static int rsmu_write_device(struct rsmu_ddata *rsmu, u8 reg, u8 *buf, u16 bytes
  * 1-byte (1B) offset addressing:
  * 16-bit register address: the lower 7 bits of the register address come
  * from the offset addr byte and the upper 9 bits come from the page register.
+ *
+ * Fill in the page register write for reg: cmd[0] is the page register and
+ * *bytes the number of page bytes after it, 0 if reg needs no page select.
  */
-static int rsmu_write_page_register(struct rsmu_ddata *rsmu, u32 reg)
+static int rsmu_page_cmd(struct rsmu_ddata *rsmu, u32 reg, u32 *page,
+			 u8 *cmd, u16 *bytes)
 {
-	u8 page_reg;
-	u8 buf[4];
-	u16 bytes;
-	u32 page;
-	int err;
+	*bytes = 0;
 
 	switch (rsmu->type) {
 	case RSMU_CM:
 		/* Do not modify page register for none-scsr registers */
 		if (reg < RSMU_CM_SCSR_BASE)
 			return 0;
-		page_reg = RSMU_CM_PAGE_ADDR;
-		page = reg & RSMU_PAGE_MASK;
-		buf[0] = (u8)(page & 0xFF);
-		buf[1] = (u8)((page >> 8) & 0xFF);
-		buf[2] = (u8)((page >> 16) & 0xFF);
-		buf[3] = (u8)((page >> 24) & 0xFF);
-		bytes = 4;
+		*page = reg & RSMU_PAGE_MASK;
+		cmd[0] = RSMU_CM_PAGE_ADDR;
+		cmd[1] = (u8)(*page & 0xFF);
+		cmd[2] = (u8)((*page >> 8) & 0xFF);
+		cmd[3] = (u8)((*page >> 16) & 0xFF);
+		cmd[4] = (u8)((*page >> 24) & 0xFF);
+		*bytes = 4;
 		break;
 	case RSMU_SABRE:
 		/* Do not modify page register if reg is page register itself */
 		if ((reg & RSMU_ADDR_MASK) == RSMU_ADDR_MASK)
 			return 0;
-		page_reg = RSMU_SABRE_PAGE_ADDR;
-		page = reg & RSMU_PAGE_MASK;
+		*page = reg & RSMU_PAGE_MASK;
+		cmd[0] = RSMU_SABRE_PAGE_ADDR;
 		/* The three page bits are located in the single Page Register */
-		buf[0] = (u8)((page >> 7) & 0x7);
-		bytes = 1;
+		cmd[1] = (u8)((*page >> 7) & 0x7);
+		*bytes = 1;
 		break;
 	default:
 		dev_err(rsmu->dev, "Unsupported RSMU device type: %d\n", rsmu->type);
 		return -ENODEV;
 	}
 
+	return 0;
+}
+
+static int rsmu_write_page_register(struct rsmu_ddata *rsmu, u32 reg)
+{
+	u8 cmd[5];
+	u16 bytes;
+	u32 page;
+	int err;
+
+	err = rsmu_page_cmd(rsmu, reg, &page, cmd, &bytes);
+	if (err || !bytes)
+		return err;
+
 	/* Simply return if we are on the same page */
 	if (rsmu->page == page)
 		return 0;
 
-	err = rsmu_write_device(rsmu, page_reg, buf, bytes);
+	err = rsmu_write_device(rsmu, cmd[0], &cmd[1], bytes);
 	if (err)
 		dev_err(rsmu->dev, "Failed to set page offset 0x%x\n", page);
 	else
@@ -141,6 +155,106 @@ static int rsmu_write_page_register(struct rsmu_ddata *rsmu, u32 reg)
 	return err;
 }
 
+/*
+ * Run a whole transaction as one spi_message: every page select and access
+ * is its own transfer with chip select toggled in between.
+ */
+static int rsmu_spi_txn_xfer(struct rsmu_ddata *rsmu, struct rsmu_txn *txn)
+{
+	struct spi_device *client = to_spi_device(rsmu->dev);
+	struct spi_transfer *xfers, *xfer;
+	u32 next, page = rsmu->page;
+	struct rsmu_txn_op *op;
+	struct spi_message msg;
+	size_t buf_len = 0;
+	u8 *tx, *rx, *p;
+	int n = 0, err;
+	u16 bytes, i;
+
+	/* Worst case: a page select and a command byte per op */
+	for (i = 0; i < txn->n_ops; i++)
+		buf_len += 5 + 1 + txn->ops[i].len;
+
+	xfers = kcalloc(2 * txn->n_ops, sizeof(*xfers), GFP_KERNEL);
+	tx = kzalloc(buf_len, GFP_KERNEL);
+	rx = kzalloc(buf_len, GFP_KERNEL);
+	if (!xfers || !tx || !rx) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	spi_message_init(&msg);
+	p = tx;
+
+	for (i = 0; i < txn->n_ops; i++) {
+		op = &txn->ops[i];
+
+		err = rsmu_page_cmd(rsmu, op->addr, &next, p, &bytes);
+		if (err)
+			goto out;
+
+		if (bytes && next != page) {
+			page = next;
+			xfer = &xfers[n++];
+			xfer->tx_buf = p;
+			xfer->len = bytes + 1;
+			p += bytes + 1;
+		}
+
+		xfer = &xfers[n++];
+		xfer->tx_buf = p;
+		xfer->len = op->len + 1;
+
+		p[0] = (u8)(op->addr & RSMU_ADDR_MASK);
+		if (op->read) {
+			p[0] |= 0x80;
+			/* The first byte clocked back is a dummy */
+			xfer->rx_buf = rx + (p - tx);
+		} else {
+			memcpy(&p[1], &txn->data[op->offset], op->len);
+		}
+		p += op->len + 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		xfers[i].bits_per_word = client->bits_per_word;
+		xfers[i].speed_hz = client->max_speed_hz;
+		xfers[i].cs_change = i < n - 1;
+		spi_message_add_tail(&xfers[i], &msg);
+	}
+
+	err = spi_sync(client, &msg);
+	if (err) {
+		/* Some page select may or may not have landed */
+		rsmu->page = RSMU_PAGE_UNKNOWN;
+		dev_err(rsmu->dev, "spi_sync failed: %d\n", err);
+		goto out;
+	}
+
+	rsmu->page = page;
+
+	/* Only read transfers have an rx_buf, and they are in op order */
+	xfer = xfers;
+	for (i = 0; i < txn->n_ops; i++) {
+		op = &txn->ops[i];
+		if (!op->read)
+			continue;
+
+		while (!xfer->rx_buf)
+			xfer++;
+
+		memcpy(&txn->data[op->offset], (u8 *)xfer->rx_buf + 1, op->len);
+		xfer++;
+	}
+
+out:
+	kfree(xfers);
+	kfree(tx);
+	kfree(rx);
+
+	return err;
+}
+
 static int rsmu_reg_read(void *context, unsigned int reg, unsigned int *val)
 {
 	struct rsmu_ddata *rsmu = spi_get_drvdata((struct spi_device *)context);
@@ -231,6 +345,9 @@ static int rsmu_spi_probe(struct spi_device *client)
 		return ret;
 	}
 
+	rsmu->page_mask = RSMU_PAGE_MASK;
+	rsmu->txn_xfer = rsmu_spi_txn_xfer;
+
 	return rsmu_core_init(rsmu);
 }
 
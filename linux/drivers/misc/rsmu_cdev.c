@@ -15,14 +15,24 @@
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <linux/mfd/rsmu.h>
 #include "rsmu_cdev.h"
 
+/* Fixed point FFO history weights, FFOs clamped to +/-1000 ppm cannot overflow */
+#define FFO_HISTORY_WEIGHT_ONE	(1 << 12)
+#define FFO_HISTORY_MAX		1000000000000LL
+
 static DEFINE_IDA(rsmu_cdev_map);
 
 /*
@@ -32,6 +42,21 @@ static DEFINE_IDA(rsmu_cdev_map);
 static char *firmware;
 module_param(firmware, charp, 0);
 
+static u32 status_period_ms = 100;
+module_param(status_period_ms, uint, 0644);
+MODULE_PARM_DESC(status_period_ms,
+"refresh period (100ms by default) of the mmap status page, 0 disables mmap");
+
+static bool status_phase;
+module_param(status_phase, bool, 0644);
+MODULE_PARM_DESC(status_phase,
+"also refresh the dpll phase table of the mmap status page (off by default)");
+
+static u32 tdc_ring_len = 65536;
+module_param(tdc_ring_len, uint, 0644);
+MODULE_PARM_DESC(tdc_ring_len,
+"TDC stream ring size in samples (65536 by default), rounded down to a power of 2");
+
 static struct rsmu_ops *ops_array[] = {
 	[0] = &cm_ops,
 	[1] = &sabre_ops,
@@ -106,12 +131,45 @@ rsmu_get_dpll_ffo(struct rsmu_cdev *rsmu, void __user *arg)
 	return err;
 }
 
+/*
+ * Average of the newest entries of an FFO history, called with rsmu->lock
+ * held. Returns the number of entries averaged, 0 if there are none.
+ */
+static u32 rsmu_ffo_history_average(const struct rsmu_ffo_history *hist, s64 *ffo)
+{
+	const struct rsmu_holdover_history *cfg = &hist->cfg;
+	u32 n = min_t(u32, hist->count, cfg->window);
+	u32 weight = FFO_HISTORY_WEIGHT_ONE;
+	u32 weight_sum = 0;
+	s64 sum = 0;
+	u32 slot = hist->head;
+	u32 i;
+
+	if (!n)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		slot = (slot ? slot : RSMU_FFO_HISTORY_LEN) - 1;
+		sum += hist->entry[slot] * weight;
+		weight_sum += weight;
+
+		if (cfg->weighting == RSMU_HISTORY_EXPONENTIAL)
+			weight -= DIV_ROUND_UP(weight, 1 << cfg->weight_shift);
+	}
+
+	*ffo = div_s64(sum, weight_sum);
+
+	return n;
+}
+
 static int
 rsmu_set_holdover_mode(struct rsmu_cdev *rsmu, void __user *arg)
 {
 	struct rsmu_ops *ops = rsmu->ops;
 	struct rsmu_holdover_mode request;
-	int err;
+	struct rsmu_ffo_history *hist;
+	int err = 0;
+	s64 ffo;
 
 	if (copy_from_user(&request, arg, sizeof(request)))
 		return -EFAULT;
@@ -120,7 +178,18 @@ rsmu_set_holdover_mode(struct rsmu_cdev *rsmu, void __user *arg)
 		return -EOPNOTSUPP;
 
 	mutex_lock(rsmu->lock);
-	err = ops->set_holdover_mode(rsmu, request.dpll, request.enable, request.mode);
+	if (request.enable && request.dpll < RSMU_MAX_DPLLS) {
+		hist = &rsmu->ffo_history[request.dpll];
+
+		/* Without any entry, the device falls back to its own history */
+		if (hist->cfg.enable && hist->cfg.preload &&
+		    rsmu_ffo_history_average(hist, &ffo)) {
+			err = ops->set_holdover_ffo(rsmu, request.dpll, ffo);
+			request.mode = HOLDOVER_MODE_MANUAL;
+		}
+	}
+	if (!err)
+		err = ops->set_holdover_mode(rsmu, request.dpll, request.enable, request.mode);
 	mutex_unlock(rsmu->lock);
 
 	return err;
@@ -181,6 +250,107 @@ rsmu_reg_write(struct rsmu_cdev *rsmu, void __user *arg)
 	return err;
 }
 
+/* Split every range into bursts that fit one bus access within one page */
+static int
+rsmu_reg_rwv_xfer(struct rsmu_cdev *rsmu, const struct rsmu_reg_seg *segs,
+		  u32 num_segs, u8 *data, bool read)
+{
+	u32 page_mask = rsmu->mfd_ddata->page_mask;
+	u32 addr, len, chunk;
+	int err = 0;
+	u32 i;
+
+	for (i = 0; i < num_segs && !err; i++) {
+		addr = segs[i].offset;
+		len = segs[i].len;
+
+		while (len && !err) {
+			chunk = min_t(u32, len, read ? RSMU_MAX_READ_COUNT :
+						       RSMU_MAX_WRITE_COUNT);
+			if (page_mask)
+				chunk = min_t(u32, chunk, (addr | ~page_mask) - addr + 1);
+
+			if (read)
+				err = regmap_bulk_read(rsmu->regmap, addr, data, chunk);
+			else
+				err = regmap_bulk_write(rsmu->regmap, addr, data, chunk);
+
+			addr += chunk;
+			data += chunk;
+			len -= chunk;
+		}
+	}
+
+	return err;
+}
+
+static int
+rsmu_reg_rwv(struct rsmu_cdev *rsmu, void __user *arg, bool read)
+{
+	struct rsmu_reg_seg *segs;
+	struct rsmu_reg_rwv rwv;
+	size_t total = 0;
+	u8 *data, *p;
+	int err = 0;
+	u32 i;
+
+	if (copy_from_user(&rwv, arg, sizeof(rwv)))
+		return -EFAULT;
+
+	if (rwv.num_segs == 0)
+		return 0;
+
+	if (rwv.num_segs > RSMU_REG_RWV_MAX_SEGS)
+		return -EINVAL;
+
+	segs = memdup_user(u64_to_user_ptr(rwv.segs), rwv.num_segs * sizeof(*segs));
+	if (IS_ERR(segs))
+		return PTR_ERR(segs);
+
+	for (i = 0; i < rwv.num_segs; i++) {
+		if (segs[i].len > RSMU_REG_RWV_MAX_BYTES - total) {
+			err = -EINVAL;
+			goto out_segs;
+		}
+		total += segs[i].len;
+	}
+
+	data = kvmalloc(total, GFP_KERNEL);
+	if (!data) {
+		err = -ENOMEM;
+		goto out_segs;
+	}
+
+	/* Keep user memory faults out of the locked section */
+	if (!read) {
+		for (i = 0, p = data; i < rwv.num_segs; p += segs[i].len, i++) {
+			if (copy_from_user(p, u64_to_user_ptr(segs[i].buf), segs[i].len)) {
+				err = -EFAULT;
+				goto out_data;
+			}
+		}
+	}
+
+	mutex_lock(rsmu->lock);
+	err = rsmu_reg_rwv_xfer(rsmu, segs, rwv.num_segs, data, read);
+	mutex_unlock(rsmu->lock);
+
+	if (read && !err) {
+		for (i = 0, p = data; i < rwv.num_segs; p += segs[i].len, i++) {
+			if (copy_to_user(u64_to_user_ptr(segs[i].buf), p, segs[i].len)) {
+				err = -EFAULT;
+				break;
+			}
+		}
+	}
+
+out_data:
+	kvfree(data);
+out_segs:
+	kfree(segs);
+	return err;
+}
+
 static int
 rsmu_get_clock_index(struct rsmu_cdev *rsmu, void __user *arg)
 {
@@ -265,8 +435,12 @@ rsmu_get_tdc_meas(struct rsmu_cdev *rsmu, void __user *arg)
 	if (copy_from_user(&meas, arg, sizeof(meas)))
 		return -EFAULT;
 
+	/* Background draining owns the FIFO, a foreground read would race it */
 	mutex_lock(rsmu->lock);
-	err = ops->get_tdc_meas(rsmu, meas.continuous, &meas.offset);
+	if (rsmu->tdc_stream || rsmu->tdc_stats)
+		err = -EBUSY;
+	else
+		err = ops->get_tdc_meas(rsmu, meas.continuous, &meas.offset);
 	mutex_unlock(rsmu->lock);
 
 	if (copy_to_user(arg, &meas, sizeof(meas)))
@@ -275,153 +449,1560 @@ rsmu_get_tdc_meas(struct rsmu_cdev *rsmu, void __user *arg)
 	return err;
 }
 
-static struct rsmu_cdev *file2rsmu(struct file *file)
+static int
+rsmu_get_tdc_meas_batch(struct rsmu_cdev *rsmu, void __user *arg)
 {
-	return container_of(file->private_data, struct rsmu_cdev, miscdev);
-}
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_tdc_meas_batch *batch;
+	int err;
 
-static long
-rsmu_ioctl(struct file *fptr, unsigned int cmd, unsigned long data)
-{
-	struct rsmu_cdev *rsmu = file2rsmu(fptr);
-	void __user *arg = (void __user *)data;
-	int err = 0;
+	if (ops->get_tdc_meas_batch == NULL)
+		return -EOPNOTSUPP;
 
-	switch (cmd) {
-	case RSMU_SET_COMBOMODE:
-		err = rsmu_set_combomode(rsmu, arg);
-		break;
-	case RSMU_GET_STATE:
-		err = rsmu_get_dpll_state(rsmu, arg);
-		break;
-	case RSMU_GET_FFO:
-		err = rsmu_get_dpll_ffo(rsmu, arg);
-		break;
-	case RSMU_SET_HOLDOVER_MODE:
-		err = rsmu_set_holdover_mode(rsmu, arg);
-		break;
-	case RSMU_SET_OUTPUT_TDC_GO:
-		err = rsmu_set_output_tdc_go(rsmu, arg);
-		break;
-	case RSMU_GET_CURRENT_CLOCK_INDEX:
-		err = rsmu_get_clock_index(rsmu, arg);
-		break;
-	case RSMU_SET_CLOCK_PRIORITIES:
-		err = rsmu_set_clock_priorities(rsmu, arg);
-		break;
-	case RSMU_GET_REFERENCE_MONITOR_STATUS:
-		err = rsmu_get_reference_monitor_status(rsmu, arg);
-		break;
-	case RSMU_GET_TDC_MEAS:
-		err = rsmu_get_tdc_meas(rsmu, arg);
-		break;
-	case RSMU_REG_READ:
-		err = rsmu_reg_read(rsmu, arg);
-		break;
-	case RSMU_REG_WRITE:
-		err = rsmu_reg_write(rsmu, arg);
-		break;
-	default:
-		/* Should not get here */
-		dev_err(rsmu->dev, "Undefined RSMU IOCTL");
-		err = -EINVAL;
-		break;
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+
+	if (copy_from_user(&batch->max_samples, arg, sizeof(batch->max_samples))) {
+		err = -EFAULT;
+		goto out;
 	}
 
+	mutex_lock(rsmu->lock);
+	if (rsmu->tdc_stream || rsmu->tdc_stats)
+		err = -EBUSY;
+	else
+		err = ops->get_tdc_meas_batch(rsmu, batch);
+	mutex_unlock(rsmu->lock);
+
+	/* Samples already popped from the FIFO are returned even on error */
+	if (copy_to_user(arg, batch, sizeof(*batch)))
+		err = -EFAULT;
+out:
+	kfree(batch);
 	return err;
 }
 
-static long rsmu_compat_ioctl(struct file *fptr, unsigned int cmd,
-			      unsigned long data)
+static int
+rsmu_get_output_tdc_meas(struct rsmu_cdev *rsmu, void __user *arg)
 {
-	return rsmu_ioctl(fptr, cmd, data);
-}
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_output_tdc_meas meas;
+	u64 start;
+	int err;
 
-static const struct file_operations rsmu_fops = {
-	.owner = THIS_MODULE,
-	.unlocked_ioctl = rsmu_ioctl,
-	.compat_ioctl =	rsmu_compat_ioctl,
-};
+	if (ops->get_output_tdc_meas == NULL)
+		return -EOPNOTSUPP;
 
-static int rsmu_init_ops(struct rsmu_cdev *rsmu)
-{
-	int i;
+	memset(&meas, 0, sizeof(meas));
 
-	for (i = 0; i < ARRAY_SIZE(ops_array); i++)
-		if (ops_array[i]->type == rsmu->type)
-			break;
+	mutex_lock(rsmu->lock);
+	start = ktime_get_raw_ns();
+	err = ops->get_output_tdc_meas(rsmu, &meas);
+	meas.timestamp = start + (ktime_get_raw_ns() - start) / 2;
+	mutex_unlock(rsmu->lock);
 
-	if (i == ARRAY_SIZE(ops_array))
-		return -EINVAL;
+	if (err)
+		return err;
+
+	if (copy_to_user(arg, &meas, sizeof(meas)))
+		return -EFAULT;
 
-	rsmu->ops = ops_array[i];
 	return 0;
 }
 
 static int
-rsmu_probe(struct platform_device *pdev)
+rsmu_read_phase_table(struct rsmu_cdev *rsmu, struct rsmu_phase_table *table)
 {
-	struct rsmu_ddata *ddata = dev_get_drvdata(pdev->dev.parent);
-	struct rsmu_cdev *rsmu;
+	struct rsmu_ops *ops = rsmu->ops;
+	u64 start;
 	int err;
 
-	rsmu = devm_kzalloc(&pdev->dev, sizeof(*rsmu), GFP_KERNEL);
-	if (!rsmu)
-		return -ENOMEM;
+	memset(table, 0, sizeof(*table));
 
-	/* Save driver private data */
-	platform_set_drvdata(pdev, rsmu);
+	mutex_lock(rsmu->lock);
+	start = ktime_get_raw_ns();
+	err = ops->get_phase_table(rsmu, table);
+	table->timestamp = start + (ktime_get_raw_ns() - start) / 2;
+	mutex_unlock(rsmu->lock);
 
-	rsmu->dev = &pdev->dev;
-	rsmu->mfd = pdev->dev.parent;
-	rsmu->type = ddata->type;
-	rsmu->lock = &ddata->lock;
-	rsmu->regmap = ddata->regmap;
-	rsmu->index = ida_simple_get(&rsmu_cdev_map, 0, MINORMASK + 1, GFP_KERNEL);
-	if (rsmu->index < 0) {
-		dev_err(rsmu->dev, "Unable to get index %d\n", rsmu->index);
-		return rsmu->index;
-	}
-	snprintf(rsmu->name, sizeof(rsmu->name), "rsmu%d", rsmu->index);
+	return err;
+}
 
-	err = rsmu_init_ops(rsmu);
-	if (err) {
-		dev_err(rsmu->dev, "Unknown SMU type %d", rsmu->type);
-		ida_simple_remove(&rsmu_cdev_map, rsmu->index);
+static int
+rsmu_get_phase_table(struct rsmu_cdev *rsmu, void __user *arg)
+{
+	struct rsmu_phase_table table;
+	int err;
+
+	if (rsmu->ops->get_phase_table == NULL)
+		return -EOPNOTSUPP;
+
+	err = rsmu_read_phase_table(rsmu, &table);
+	if (err)
 		return err;
-	}
 
-	if (rsmu->ops->device_init) {
-		err = rsmu->ops->device_init(rsmu, firmware);
-		if (err) {
-			dev_err(rsmu->dev, "Device initialization failed\n");
-			ida_simple_remove(&rsmu_cdev_map, rsmu->index);
+	if (copy_to_user(arg, &table, sizeof(table)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static u8 alarms_to_bits(const struct rsmu_reference_monitor_status_alarms *alarms)
+{
+	return (alarms->los ? RSMU_ALARM_LOS : 0) |
+	       (alarms->no_activity ? RSMU_ALARM_NO_ACTIVITY : 0) |
+	       (alarms->frequency_offset_limit ? RSMU_ALARM_FREQUENCY_OFFSET : 0);
+}
+
+/*
+ * Fold a sample into the alarm accumulator. An alarm counts as asserted
+ * when it is seen, live or latched by the device, after being clear at
+ * the previous sample. Called with rsmu->lock held.
+ */
+static int
+rsmu_update_alarms(struct rsmu_cdev *rsmu, const struct rsmu_status_snapshot *snapshot)
+{
+	struct rsmu_ops *ops = rsmu->ops;
+	u8 seen[RSMU_MAX_INPUTS] = {0};
+	u8 live;
+	u8 rising;
+	u8 i, b;
+	int err;
+
+	if (ops->read_clear_sticky_alarms) {
+		err = ops->read_clear_sticky_alarms(rsmu, seen);
+		if (err)
 			return err;
-		}
 	}
 
-	/* Initialize and register the miscdev */
-	rsmu->miscdev.minor = MISC_DYNAMIC_MINOR;
-	rsmu->miscdev.fops = &rsmu_fops;
-	rsmu->miscdev.name = rsmu->name;
-	err = misc_register(&rsmu->miscdev);
-	if (err) {
-		dev_err(rsmu->dev, "Unable to register device\n");
-		ida_simple_remove(&rsmu_cdev_map, rsmu->index);
-		return -ENODEV;
+	for (i = 0; i < snapshot->num_inputs; i++) {
+		live = alarms_to_bits(&snapshot->alarms[i]);
+		seen[i] |= live;
+		rising = seen[i] & ~rsmu->alarm_level[i];
+
+		for (b = 0; b < RSMU_NUM_ALARMS; b++)
+			if (rising & BIT(b))
+				rsmu->alarm_count[i][b]++;
+
+		rsmu->alarm_level[i] = live;
+		rsmu->alarm_latched[i] |= seen[i];
 	}
 
-	dev_info(rsmu->dev, "Probe %s successful\n", rsmu->name);
 	return 0;
 }
 
+/* Called with rsmu->lock held */
 static int
-rsmu_remove(struct platform_device *pdev)
+__rsmu_read_status_snapshot(struct rsmu_cdev *rsmu, struct rsmu_status_snapshot *snapshot)
 {
-	struct rsmu_cdev *rsmu = platform_get_drvdata(pdev);
+	struct rsmu_ops *ops = rsmu->ops;
+	u64 start;
+	int err;
 
-	misc_deregister(&rsmu->miscdev);
-	ida_simple_remove(&rsmu_cdev_map, rsmu->index);
+	memset(snapshot, 0, sizeof(*snapshot));
+
+	start = ktime_get_raw_ns();
+	err = ops->get_status_snapshot(rsmu, snapshot);
+	snapshot->timestamp = start + (ktime_get_raw_ns() - start) / 2;
+	if (err)
+		return err;
+
+	if (rsmu->alarm_owner)
+		return rsmu_update_alarms(rsmu, snapshot);
+
+	return 0;
+}
+
+static int
+rsmu_read_status_snapshot(struct rsmu_cdev *rsmu, struct rsmu_status_snapshot *snapshot)
+{
+	int err;
+
+	mutex_lock(rsmu->lock);
+	err = __rsmu_read_status_snapshot(rsmu, snapshot);
+	mutex_unlock(rsmu->lock);
+
+	return err;
+}
+
+static int
+rsmu_get_status_snapshot(struct rsmu_cdev *rsmu, void __user *arg)
+{
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_status_snapshot snapshot;
+	int err;
+
+	if (ops->get_status_snapshot == NULL)
+		return -EOPNOTSUPP;
+
+	err = rsmu_read_status_snapshot(rsmu, &snapshot);
+	if (err)
+		return err;
+
+	if (copy_to_user(arg, &snapshot, sizeof(snapshot)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int
+rsmu_batch_run_op(struct rsmu_cdev *rsmu, struct rsmu_batch_op *op)
+{
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_get_ffo ffo = {0};
+	s8 clock_index;
+	u8 state;
+	int err;
+
+	switch (op->op) {
+	case RSMU_BATCH_GET_STATE:
+		if (ops->get_dpll_state == NULL)
+			return -EOPNOTSUPP;
+		err = ops->get_dpll_state(rsmu, op->state.dpll, &state);
+		op->state.state = state;
+		return err;
+	case RSMU_BATCH_GET_FFO:
+		if (ops->get_dpll_ffo == NULL)
+			return -EOPNOTSUPP;
+		ffo.dpll = op->ffo.dpll;
+		err = ops->get_dpll_ffo(rsmu, op->ffo.dpll, &ffo);
+		op->ffo.ffo = ffo.ffo;
+		return err;
+	case RSMU_BATCH_GET_CURRENT_CLOCK_INDEX:
+		if (ops->get_clock_index == NULL)
+			return -EOPNOTSUPP;
+		err = ops->get_clock_index(rsmu, op->clock_index.dpll, &clock_index);
+		op->clock_index.clock_index = clock_index;
+		return err;
+	case RSMU_BATCH_GET_REFERENCE_MONITOR_STATUS:
+		if (ops->get_reference_monitor_status == NULL)
+			return -EOPNOTSUPP;
+		return ops->get_reference_monitor_status(rsmu, op->ref_mon_status.clock_index,
+							 &op->ref_mon_status.alarms);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+rsmu_batch(struct rsmu_cdev *rsmu, void __user *arg)
+{
+	struct rsmu_batch_op *ops;
+	struct rsmu_batch batch;
+	void __user *uops;
+	size_t size;
+	u32 i;
+	int err = 0;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.num_ops == 0)
+		return 0;
+
+	if (batch.num_ops > RSMU_BATCH_MAX_OPS)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(batch.ops);
+	size = batch.num_ops * sizeof(*ops);
+
+	ops = memdup_user(uops, size);
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	mutex_lock(rsmu->lock);
+	for (i = 0; i < batch.num_ops; i++)
+		ops[i].err = rsmu_batch_run_op(rsmu, &ops[i]);
+	mutex_unlock(rsmu->lock);
+
+	if (copy_to_user(uops, ops, size))
+		err = -EFAULT;
+
+	kfree(ops);
+	return err;
+}
+
+#define RSMU_EVENT_QUEUE_LEN	(64)
+
+/**
+ * struct rsmu_client - per open file data
+ * @list: entry in &rsmu_cdev.clients
+ * @rsmu: device the file is open on
+ * @mask: events to queue
+ * @overflow: events were dropped since the last read
+ * @events: queued events
+ */
+struct rsmu_client {
+	struct list_head list;
+	struct rsmu_cdev *rsmu;
+	struct rsmu_event_mask mask;
+	bool overflow;
+	DECLARE_KFIFO(events, struct rsmu_event, RSMU_EVENT_QUEUE_LEN);
+};
+
+static struct rsmu_cdev *file2rsmu(struct file *file)
+{
+	struct rsmu_client *client = file->private_data;
+
+	return client->rsmu;
+}
+
+static void rsmu_free(struct kref *kref)
+{
+	kfree(container_of(kref, struct rsmu_cdev, kref));
+}
+
+/* The sampler runs while the status page is mapped or events are selected */
+static void rsmu_status_get(struct rsmu_cdev *rsmu)
+{
+	/* The first user starts the sampler with an immediate refresh */
+	spin_lock(&rsmu->client_lock);
+	if (atomic_inc_return(&rsmu->status_users) == 1 && !rsmu->removed)
+		mod_delayed_work(system_wq, &rsmu->status_work, 0);
+	spin_unlock(&rsmu->client_lock);
+}
+
+static void rsmu_status_put(struct rsmu_cdev *rsmu)
+{
+	atomic_dec(&rsmu->status_users);
+}
+
+static bool rsmu_event_pending(struct rsmu_client *client)
+{
+	return !kfifo_is_empty(&client->events) || READ_ONCE(client->overflow);
+}
+
+/* Called with client_lock held, returns true if anyone got the event */
+static bool rsmu_queue_event(struct rsmu_cdev *rsmu, const struct rsmu_event *event)
+{
+	struct rsmu_client *client;
+	bool queued = false;
+	u32 index_mask;
+
+	list_for_each_entry(client, &rsmu->clients, list) {
+		if (!(client->mask.events & event->type))
+			continue;
+
+		switch (event->type) {
+		case RSMU_EVENT_DPLL_STATE:
+		case RSMU_EVENT_REF_SWITCH:
+		case RSMU_EVENT_FAILOVER:
+			index_mask = client->mask.dpll_mask;
+			break;
+		case RSMU_EVENT_MONITOR_ALARM:
+			index_mask = client->mask.input_mask;
+			break;
+		default:
+			index_mask = ~0;
+			break;
+		}
+
+		if (!(index_mask & BIT(event->index)))
+			continue;
+
+		if (!kfifo_put(&client->events, *event))
+			client->overflow = true;
+
+		queued = true;
+	}
+
+	return queued;
+}
+
+/* Called with client_lock held */
+static bool rsmu_queue_status_events(struct rsmu_cdev *rsmu,
+				     const struct rsmu_status_snapshot *prev,
+				     const struct rsmu_status_snapshot *cur)
+{
+	struct rsmu_event event = { .timestamp = cur->timestamp };
+	bool queued = false;
+	u8 i;
+
+	for (i = 0; i < cur->num_dplls; i++) {
+		event.index = i;
+
+		if (cur->state[i] != prev->state[i]) {
+			event.type = RSMU_EVENT_DPLL_STATE;
+			event.old_value = prev->state[i];
+			event.new_value = cur->state[i];
+			queued |= rsmu_queue_event(rsmu, &event);
+		}
+
+		if (cur->clock_index[i] != prev->clock_index[i]) {
+			event.type = RSMU_EVENT_REF_SWITCH;
+			event.old_value = prev->clock_index[i];
+			event.new_value = cur->clock_index[i];
+			queued |= rsmu_queue_event(rsmu, &event);
+		}
+	}
+
+	event.type = RSMU_EVENT_MONITOR_ALARM;
+
+	for (i = 0; i < cur->num_inputs; i++) {
+		event.index = i;
+		event.old_value = alarms_to_bits(&prev->alarms[i]);
+		event.new_value = alarms_to_bits(&cur->alarms[i]);
+
+		if (event.old_value != event.new_value)
+			queued |= rsmu_queue_event(rsmu, &event);
+	}
+
+	return queued;
+}
+
+/*
+ * Program the qualified candidates of every failover policy whose list
+ * changed since the last sample, returns true if an event was queued.
+ */
+static bool rsmu_failover_run(struct rsmu_cdev *rsmu,
+			      const struct rsmu_status_snapshot *snapshot)
+{
+	struct rsmu_priority_entry entries[RSMU_FAILOVER_MAX_CANDIDATES];
+	struct rsmu_event event = { .timestamp = snapshot->timestamp };
+	u8 qualified[RSMU_FAILOVER_MAX_CANDIDATES];
+	struct rsmu_failover *fo;
+	bool queued = false;
+	u8 clock_index;
+	u8 dpll;
+	u8 n;
+	u8 i;
+	int err;
+
+	mutex_lock(rsmu->lock);
+
+	for (dpll = 0; dpll < RSMU_MAX_DPLLS; dpll++) {
+		fo = &rsmu->failover[dpll];
+		if (!fo->policy.enable)
+			continue;
+
+		n = 0;
+		for (i = 0; i < fo->policy.num_candidates; i++) {
+			clock_index = fo->policy.candidates[i];
+			if (clock_index < snapshot->num_inputs &&
+			    !(alarms_to_bits(&snapshot->alarms[clock_index]) &
+			      fo->policy.alarm_mask))
+				qualified[n++] = clock_index;
+		}
+
+		/* Nothing better to switch to, leave the DPLL to its own devices */
+		if (!n)
+			continue;
+
+		if (fo->applied && n == fo->num_active && !memcmp(qualified, fo->active, n))
+			continue;
+
+		for (i = 0; i < n; i++) {
+			entries[i].clock_index = qualified[i];
+			entries[i].priority = i;
+		}
+
+		err = rsmu->ops->set_clock_priorities(rsmu, dpll, n, entries);
+		if (err) {
+			/* Retried on the next sample */
+			dev_warn_ratelimited(rsmu->dev, "dpll %u failover failed with %d",
+					     dpll, err);
+			continue;
+		}
+
+		event.type = RSMU_EVENT_FAILOVER;
+		event.index = dpll;
+		event.old_value = fo->num_active ? fo->active[0] : -1;
+		event.new_value = qualified[0];
+
+		if (event.old_value != event.new_value)
+			dev_info(rsmu->dev, "dpll %u failover from clock %d to %d",
+				 dpll, event.old_value, event.new_value);
+
+		memcpy(fo->active, qualified, n);
+		fo->num_active = n;
+		fo->applied = true;
+
+		spin_lock(&rsmu->client_lock);
+		queued |= rsmu_queue_event(rsmu, &event);
+		spin_unlock(&rsmu->client_lock);
+	}
+
+	mutex_unlock(rsmu->lock);
+
+	return queued;
+}
+
+/*
+ * Record the FFO of every DPLL with a history. Samples out of lock are
+ * skipped, holdover would otherwise feed the history with its own output.
+ */
+static void rsmu_ffo_history_run(struct rsmu_cdev *rsmu,
+				 const struct rsmu_status_snapshot *snapshot)
+{
+	struct rsmu_ffo_history *hist;
+	u8 state;
+	u8 dpll;
+
+	mutex_lock(rsmu->lock);
+
+	for (dpll = 0; dpll < snapshot->num_dplls; dpll++) {
+		hist = &rsmu->ffo_history[dpll];
+		if (!hist->cfg.enable)
+			continue;
+
+		state = snapshot->state[dpll];
+		if (!(snapshot->ffo_valid & BIT(dpll)) ||
+		    (state != E_SRVLOFREQUENCYLOCKEDSTATE && state != E_SRVLOTIMELOCKEDSTATE)) {
+			hist->acc = 0;
+			hist->acc_count = 0;
+			continue;
+		}
+
+		hist->acc += clamp_t(s64, snapshot->ffo[dpll], -FFO_HISTORY_MAX, FFO_HISTORY_MAX);
+		if (++hist->acc_count < hist->cfg.decimation)
+			continue;
+
+		hist->entry[hist->head] = div_s64(hist->acc, hist->acc_count);
+		hist->head = (hist->head + 1) % RSMU_FFO_HISTORY_LEN;
+		if (hist->count < RSMU_FFO_HISTORY_LEN)
+			hist->count++;
+
+		hist->acc = 0;
+		hist->acc_count = 0;
+	}
+
+	mutex_unlock(rsmu->lock);
+}
+
+static void rsmu_status_work(struct work_struct *work)
+{
+	struct rsmu_cdev *rsmu = container_of(work, struct rsmu_cdev, status_work.work);
+	struct rsmu_status_page *page = rsmu->status_page;
+	struct rsmu_status_snapshot snapshot;
+	struct rsmu_phase_table phase = {0};
+	u32 period_ms = READ_ONCE(status_period_ms);
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_event event = {0};
+	struct rsmu_client *client;
+	bool tdc_ready = false;
+	bool queued = false;
+	u32 events = 0;
+	int err;
+
+	err = rsmu_read_status_snapshot(rsmu, &snapshot);
+
+	/* Act on the sample before anything else reads it */
+	if (!err) {
+		queued = rsmu_failover_run(rsmu, &snapshot);
+		rsmu_ffo_history_run(rsmu, &snapshot);
+	}
+
+	if (READ_ONCE(status_phase) && ops->get_phase_table &&
+	    rsmu_read_phase_table(rsmu, &phase))
+		phase.num_dplls = 0;
+
+	/* Single writer, readers follow the protocol of struct rsmu_status_page */
+	WRITE_ONCE(page->seq, page->seq + 1);
+	smp_wmb();
+	page->err = err;
+	page->period_ms = period_ms;
+	if (!err)
+		page->snapshot = snapshot;
+	page->phase = phase;
+	smp_wmb();
+	WRITE_ONCE(page->seq, page->seq + 1);
+
+	spin_lock(&rsmu->client_lock);
+	list_for_each_entry(client, &rsmu->clients, list)
+		events |= client->mask.events;
+	spin_unlock(&rsmu->client_lock);
+
+	/* Only poll the TDC FIFO when someone is listening */
+	if ((events & RSMU_EVENT_TDC_DATA) && ops->get_tdc_ready) {
+		mutex_lock(rsmu->lock);
+		if (ops->get_tdc_ready(rsmu, &tdc_ready))
+			tdc_ready = false;
+		mutex_unlock(rsmu->lock);
+	}
+
+	spin_lock(&rsmu->client_lock);
+	if (!err && rsmu->status_prev_valid)
+		queued |= rsmu_queue_status_events(rsmu, &rsmu->status_prev, &snapshot);
+
+	if (tdc_ready && !rsmu->tdc_ready_prev) {
+		event.timestamp = ktime_get_raw_ns();
+		event.type = RSMU_EVENT_TDC_DATA;
+		event.new_value = 1;
+		queued |= rsmu_queue_event(rsmu, &event);
+	}
+	spin_unlock(&rsmu->client_lock);
+
+	if (queued)
+		wake_up_interruptible(&rsmu->event_wait);
+
+	rsmu->tdc_ready_prev = tdc_ready;
+	if (!err) {
+		rsmu->status_prev = snapshot;
+		rsmu->status_prev_valid = true;
+	}
+
+	if (period_ms && atomic_read(&rsmu->status_users))
+		schedule_delayed_work(&rsmu->status_work, msecs_to_jiffies(period_ms));
+	else
+		/* Changes while stopped are not events, start from a new baseline */
+		rsmu->status_prev_valid = false;
+}
+
+static int
+rsmu_set_event_mask(struct rsmu_client *client, void __user *arg)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+	struct rsmu_event_mask mask;
+	bool was_subscribed;
+
+	if (copy_from_user(&mask, arg, sizeof(mask)))
+		return -EFAULT;
+
+	if (mask.events & ~(RSMU_EVENT_DPLL_STATE | RSMU_EVENT_REF_SWITCH |
+			    RSMU_EVENT_MONITOR_ALARM | RSMU_EVENT_TDC_DATA |
+			    RSMU_EVENT_FAILOVER))
+		return -EINVAL;
+
+	if (mask.events && (!rsmu->status_page || !READ_ONCE(status_period_ms)))
+		return -ENODEV;
+
+	/* read() of a streaming file returns TDC samples */
+	if (mask.events && READ_ONCE(rsmu->tdc_stream) == client)
+		return -EBUSY;
+
+	spin_lock(&rsmu->client_lock);
+	was_subscribed = client->mask.events != 0;
+	client->mask = mask;
+	spin_unlock(&rsmu->client_lock);
+
+	if (!was_subscribed && mask.events)
+		rsmu_status_get(rsmu);
+	else if (was_subscribed && !mask.events)
+		rsmu_status_put(rsmu);
+
+	return 0;
+}
+
+static int
+rsmu_set_failover_policy(struct rsmu_cdev *rsmu, void __user *arg)
+{
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_failover_policy policy;
+	struct rsmu_failover *fo;
+	bool was_enabled;
+	u8 i;
+
+	if (ops->set_clock_priorities == NULL || ops->get_status_snapshot == NULL)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&policy, arg, sizeof(policy)))
+		return -EFAULT;
+
+	if (policy.dpll >= RSMU_MAX_DPLLS ||
+	    policy.num_candidates > RSMU_FAILOVER_MAX_CANDIDATES ||
+	    (policy.enable && !policy.num_candidates) ||
+	    (policy.alarm_mask & ~(RSMU_ALARM_LOS | RSMU_ALARM_NO_ACTIVITY |
+				   RSMU_ALARM_FREQUENCY_OFFSET)))
+		return -EINVAL;
+
+	for (i = 0; i < policy.num_candidates; i++)
+		if (policy.candidates[i] >= RSMU_MAX_INPUTS)
+			return -EINVAL;
+
+	/* Policies run off the status sampler */
+	if (policy.enable && (!rsmu->status_page || !READ_ONCE(status_period_ms)))
+		return -ENODEV;
+
+	policy.enable = !!policy.enable;
+
+	mutex_lock(rsmu->lock);
+	fo = &rsmu->failover[policy.dpll];
+	was_enabled = fo->policy.enable;
+	fo->policy = policy;
+	fo->applied = false;
+	mutex_unlock(rsmu->lock);
+
+	if (!was_enabled && policy.enable)
+		rsmu_status_get(rsmu);
+	else if (was_enabled && !policy.enable)
+		rsmu_status_put(rsmu);
+
+	return 0;
+}
+
+static int
+rsmu_set_holdover_history(struct rsmu_cdev *rsmu, void __user *arg)
+{
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_holdover_history cfg;
+	struct rsmu_ffo_history *hist;
+	bool was_enabled;
+	s64 ffo = 0;
+
+	if (ops->get_status_snapshot == NULL)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&cfg, arg, sizeof(cfg)))
+		return -EFAULT;
+
+	if (cfg.dpll >= RSMU_MAX_DPLLS)
+		return -EINVAL;
+
+	cfg.enable = !!cfg.enable;
+	cfg.preload = !!cfg.preload;
+
+	if (cfg.enable) {
+		if (!cfg.window || cfg.window > RSMU_FFO_HISTORY_LEN || !cfg.decimation ||
+		    cfg.weighting > RSMU_HISTORY_EXPONENTIAL ||
+		    (cfg.weighting == RSMU_HISTORY_EXPONENTIAL &&
+		     (cfg.weight_shift < 1 || cfg.weight_shift > 8)))
+			return -EINVAL;
+
+		if (cfg.preload && (ops->set_holdover_ffo == NULL || ops->set_holdover_mode == NULL))
+			return -EOPNOTSUPP;
+
+		/* The history is recorded by the status sampler */
+		if (!rsmu->status_page || !READ_ONCE(status_period_ms))
+			return -ENODEV;
+	}
+
+	mutex_lock(rsmu->lock);
+	hist = &rsmu->ffo_history[cfg.dpll];
+	was_enabled = hist->cfg.enable;
+
+	if (!cfg.enable || !was_enabled || cfg.decimation != hist->cfg.decimation) {
+		hist->head = 0;
+		hist->count = 0;
+		hist->acc = 0;
+		hist->acc_count = 0;
+	}
+
+	hist->cfg = cfg;
+	cfg.num_entries = rsmu_ffo_history_average(hist, &ffo);
+	cfg.ffo = ffo;
+	mutex_unlock(rsmu->lock);
+
+	if (!was_enabled && cfg.enable)
+		rsmu_status_get(rsmu);
+	else if (was_enabled && !cfg.enable)
+		rsmu_status_put(rsmu);
+
+	if (copy_to_user(arg, &cfg, sizeof(cfg)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int
+rsmu_get_sticky_alarms(struct rsmu_client *client, void __user *arg)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_status_snapshot snapshot;
+	struct rsmu_sticky_alarms alarms;
+	bool sample = false;
+	bool start;
+	int err;
+
+	if (ops->get_status_snapshot == NULL)
+		return -EOPNOTSUPP;
+
+	memset(&alarms, 0, sizeof(alarms));
+
+	mutex_lock(rsmu->lock);
+	/* Reading clears, so only the file that started it may read */
+	if (rsmu->alarm_owner && rsmu->alarm_owner != client) {
+		mutex_unlock(rsmu->lock);
+		return -EBUSY;
+	}
+
+	start = !rsmu->alarm_owner;
+	if (start) {
+		memset(rsmu->alarm_level, 0, sizeof(rsmu->alarm_level));
+		memset(rsmu->alarm_latched, 0, sizeof(rsmu->alarm_latched));
+		memset(rsmu->alarm_count, 0, sizeof(rsmu->alarm_count));
+		rsmu->alarm_since = 0;
+		rsmu->alarm_owner = client;
+	}
+
+	err = __rsmu_read_status_snapshot(rsmu, &snapshot);
+	if (err) {
+		if (start)
+			rsmu->alarm_owner = NULL;
+		mutex_unlock(rsmu->lock);
+		return err;
+	}
+
+	alarms.since = rsmu->alarm_since;
+	alarms.timestamp = snapshot.timestamp;
+	alarms.num_inputs = snapshot.num_inputs;
+	memcpy(alarms.alarms, rsmu->alarm_latched, sizeof(alarms.alarms));
+	memcpy(alarms.count, rsmu->alarm_count, sizeof(alarms.count));
+
+	memset(rsmu->alarm_latched, 0, sizeof(rsmu->alarm_latched));
+	rsmu->alarm_since = snapshot.timestamp;
+
+	/* From now on, sample between calls too, until the file is closed */
+	if (start && rsmu->status_page && READ_ONCE(status_period_ms)) {
+		rsmu->alarm_sampling = true;
+		sample = true;
+	}
+	mutex_unlock(rsmu->lock);
+
+	if (sample)
+		rsmu_status_get(rsmu);
+
+	if (copy_to_user(arg, &alarms, sizeof(alarms)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* Stop the alarm accumulator if this file started it */
+static void rsmu_alarm_stop(struct rsmu_client *client)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+	bool sampling;
+
+	mutex_lock(rsmu->lock);
+	if (rsmu->alarm_owner != client) {
+		mutex_unlock(rsmu->lock);
+		return;
+	}
+
+	rsmu->alarm_owner = NULL;
+	sampling = rsmu->alarm_sampling;
+	rsmu->alarm_sampling = false;
+	mutex_unlock(rsmu->lock);
+
+	if (sampling)
+		rsmu_status_put(rsmu);
+}
+
+static void rsmu_tdc_work(struct work_struct *work)
+{
+	struct rsmu_cdev *rsmu = container_of(work, struct rsmu_cdev, tdc_work.work);
+	struct rsmu_tdc_meas_batch batch = { .max_samples = TDC_FIFO_SIZE };
+	struct rsmu_tdc_sample sample;
+	int err;
+	u32 i;
+
+	mutex_lock(rsmu->lock);
+	if (!rsmu->tdc_stream && !rsmu->tdc_stats) {
+		mutex_unlock(rsmu->lock);
+		return;
+	}
+
+	/* Samples drained before a failure are still good */
+	err = rsmu->ops->drain_tdc_fifo(rsmu, &batch);
+	if (err)
+		dev_warn_ratelimited(rsmu->dev, "TDC drain failed with %d", err);
+
+	/* Statistics alone only need the FIFO drained */
+	if (!rsmu->tdc_stream)
+		batch.num_samples = 0;
+
+	sample.timestamp = ktime_get_raw_ns();
+
+	for (i = 0; i < batch.num_samples; i++) {
+		sample.offset = batch.samples[i].offset;
+		sample.seq = batch.samples[i].seq;
+		sample.flags = i ? 0 : batch.flags;
+		if (rsmu->tdc_drop_pending)
+			sample.flags |= RSMU_TDC_STREAM_DROPPED;
+
+		/* Single writer and single reader, kfifo needs no lock for that */
+		if (kfifo_put(&rsmu->tdc_ring, sample)) {
+			rsmu->tdc_drop_pending = false;
+		} else {
+			rsmu->tdc_dropped++;
+			rsmu->tdc_drop_pending = true;
+		}
+	}
+
+	rsmu->tdc_samples += batch.num_samples;
+	if (batch.flags & RSMU_TDC_MEAS_OVERRUN)
+		rsmu->tdc_overruns++;
+
+	schedule_delayed_work(&rsmu->tdc_work, rsmu->tdc_period);
+	mutex_unlock(rsmu->lock);
+
+	if (batch.num_samples)
+		wake_up_interruptible(&rsmu->event_wait);
+}
+
+/*
+ * Start draining the TDC FIFO for the first of the stream and the statistics,
+ * called with tdc_ring_lock and rsmu->lock held. Starting may drop rsmu->lock.
+ */
+static int rsmu_tdc_drain_start(struct rsmu_cdev *rsmu)
+{
+	u32 drain_period_us;
+	int err;
+
+	if (rsmu->tdc_stream || rsmu->tdc_stats)
+		return 0;
+
+	err = rsmu->ops->start_tdc_stream(rsmu, &drain_period_us);
+	if (err)
+		return err;
+
+	rsmu->tdc_draining = true;
+	rsmu->tdc_period = max_t(unsigned long, usecs_to_jiffies(drain_period_us), 1);
+	schedule_delayed_work(&rsmu->tdc_work, rsmu->tdc_period);
+
+	return 0;
+}
+
+/*
+ * Put the TDC back as it was before draining started, once neither the
+ * stream nor the statistics are left, called with rsmu->lock held. The
+ * worker finds nothing to drain from then on.
+ */
+static void rsmu_tdc_drain_stop(struct rsmu_cdev *rsmu)
+{
+	int err;
+
+	if (!rsmu->tdc_draining || rsmu->tdc_stream || rsmu->tdc_stats)
+		return;
+
+	rsmu->tdc_draining = false;
+
+	if (rsmu->ops->stop_tdc_stream == NULL)
+		return;
+
+	err = rsmu->ops->stop_tdc_stream(rsmu);
+	if (err)
+		dev_warn(rsmu->dev, "Stopping TDC measurements failed with %d", err);
+}
+
+static int rsmu_tdc_stream_start(struct rsmu_client *client)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+	struct rsmu_ops *ops = rsmu->ops;
+	u32 len = max_t(u32, READ_ONCE(tdc_ring_len), TDC_FIFO_SIZE);
+	void *buf;
+	int err = 0;
+
+	if (ops->start_tdc_stream == NULL || ops->drain_tdc_fifo == NULL)
+		return -EOPNOTSUPP;
+
+	if (READ_ONCE(client->mask.events))
+		return -EBUSY;
+
+	len = rounddown_pow_of_two(len);
+	buf = vmalloc(array_size(len, sizeof(struct rsmu_tdc_sample)));
+	if (!buf)
+		return -ENOMEM;
+
+	/* Serializes starts, since starting may drop rsmu->lock */
+	mutex_lock(&rsmu->tdc_ring_lock);
+	mutex_lock(rsmu->lock);
+
+	if (rsmu->tdc_stream) {
+		if (rsmu->tdc_stream != client)
+			err = -EBUSY;
+		goto out;
+	}
+
+	err = rsmu_tdc_drain_start(rsmu);
+	if (err)
+		goto out;
+
+	kfifo_init(&rsmu->tdc_ring, buf, len * sizeof(struct rsmu_tdc_sample));
+	rsmu->tdc_ring_buf = buf;
+	buf = NULL;
+
+	rsmu->tdc_samples = 0;
+	rsmu->tdc_dropped = 0;
+	rsmu->tdc_overruns = 0;
+	rsmu->tdc_drop_pending = false;
+	rsmu->tdc_stream = client;
+out:
+	mutex_unlock(rsmu->lock);
+	mutex_unlock(&rsmu->tdc_ring_lock);
+	vfree(buf);
+
+	return err;
+}
+
+static void rsmu_tdc_stream_stop(struct rsmu_cdev *rsmu)
+{
+	bool draining;
+
+	mutex_lock(&rsmu->tdc_ring_lock);
+
+	/* Once cleared, the worker leaves the ring alone */
+	mutex_lock(rsmu->lock);
+	rsmu->tdc_stream = NULL;
+	draining = rsmu->tdc_stats;
+	rsmu_tdc_drain_stop(rsmu);
+	mutex_unlock(rsmu->lock);
+
+	if (!draining)
+		cancel_delayed_work_sync(&rsmu->tdc_work);
+
+	vfree(rsmu->tdc_ring_buf);
+	rsmu->tdc_ring_buf = NULL;
+	kfifo_reset(&rsmu->tdc_ring);
+
+	mutex_unlock(&rsmu->tdc_ring_lock);
+
+	/* Blocked readers see the end of the stream */
+	wake_up_interruptible(&rsmu->event_wait);
+}
+
+static int
+rsmu_set_tdc_stream(struct rsmu_client *client, void __user *arg)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+	struct rsmu_tdc_stream stream;
+	bool streaming;
+	int err;
+
+	if (copy_from_user(&stream, arg, sizeof(stream)))
+		return -EFAULT;
+
+	if (stream.enable) {
+		err = rsmu_tdc_stream_start(client);
+		if (err)
+			return err;
+	}
+
+	mutex_lock(rsmu->lock);
+	streaming = rsmu->tdc_stream == client;
+	stream.ring_len = streaming ? kfifo_size(&rsmu->tdc_ring) : 0;
+	stream.samples = streaming ? rsmu->tdc_samples : 0;
+	stream.dropped = streaming ? rsmu->tdc_dropped : 0;
+	stream.overruns = streaming ? rsmu->tdc_overruns : 0;
+	mutex_unlock(rsmu->lock);
+
+	if (!stream.enable && streaming)
+		rsmu_tdc_stream_stop(rsmu);
+
+	if (copy_to_user(arg, &stream, sizeof(stream)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int
+rsmu_get_tdc_stats(struct rsmu_cdev *rsmu, void __user *arg)
+{
+	struct rsmu_ops *ops = rsmu->ops;
+	struct rsmu_tdc_stats stats;
+	bool draining;
+	bool stop;
+	int err;
+
+	if (ops->get_tdc_stats == NULL || ops->start_tdc_stream == NULL ||
+	    ops->drain_tdc_fifo == NULL)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&stats, arg, sizeof(stats)))
+		return -EFAULT;
+
+	if (stats.flags & ~(RSMU_TDC_STATS_RESET | RSMU_TDC_STATS_STOP))
+		return -EINVAL;
+
+	stop = stats.flags & RSMU_TDC_STATS_STOP;
+
+	mutex_lock(&rsmu->tdc_ring_lock);
+	mutex_lock(rsmu->lock);
+
+	if (!stop && !rsmu->tdc_stats) {
+		err = rsmu_tdc_drain_start(rsmu);
+		if (err)
+			goto out;
+		rsmu->tdc_stats = true;
+	}
+
+	err = ops->get_tdc_stats(rsmu, &stats);
+
+	if (stop)
+		rsmu->tdc_stats = false;
+out:
+	draining = rsmu->tdc_stream || rsmu->tdc_stats;
+	rsmu_tdc_drain_stop(rsmu);
+	mutex_unlock(rsmu->lock);
+
+	if (!draining)
+		cancel_delayed_work_sync(&rsmu->tdc_work);
+	mutex_unlock(&rsmu->tdc_ring_lock);
+
+	if (err)
+		return err;
+
+	if (copy_to_user(arg, &stats, sizeof(stats)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* The stream ending counts as pending, so that readers return */
+static bool rsmu_tdc_pending(struct rsmu_client *client)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+
+	return READ_ONCE(rsmu->tdc_stream) != client || !kfifo_is_empty(&rsmu->tdc_ring);
+}
+
+static ssize_t
+rsmu_tdc_read(struct rsmu_client *client, struct file *fptr,
+	      char __user *buf, size_t count)
+{
+	struct rsmu_cdev *rsmu = client->rsmu;
+	unsigned int copied;
+	int err;
+
+	count = rounddown(count, sizeof(struct rsmu_tdc_sample));
+	if (!count)
+		return -EINVAL;
+
+	for (;;) {
+		mutex_lock(&rsmu->tdc_ring_lock);
+		/* End of file once the stream is stopped */
+		if (rsmu->tdc_stream != client) {
+			mutex_unlock(&rsmu->tdc_ring_lock);
+			return 0;
+		}
+		err = kfifo_to_user(&rsmu->tdc_ring, buf, count, &copied);
+		mutex_unlock(&rsmu->tdc_ring_lock);
+
+		if (err)
+			return err;
+
+		if (copied)
+			return copied;
+
+		if (fptr->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(rsmu->event_wait, rsmu_tdc_pending(client));
+		if (err)
+			return err;
+	}
+}
+
+static void rsmu_status_vm_open(struct vm_area_struct *vma)
+{
+	struct rsmu_cdev *rsmu = vma->vm_private_data;
+
+	kref_get(&rsmu->kref);
+	rsmu_status_get(rsmu);
+}
+
+static void rsmu_status_vm_close(struct vm_area_struct *vma)
+{
+	struct rsmu_cdev *rsmu = vma->vm_private_data;
+
+	rsmu_status_put(rsmu);
+	kref_put(&rsmu->kref, rsmu_free);
+}
+
+static const struct vm_operations_struct rsmu_status_vm_ops = {
+	.open = rsmu_status_vm_open,
+	.close = rsmu_status_vm_close,
+};
+
+static int rsmu_mmap(struct file *fptr, struct vm_area_struct *vma)
+{
+	struct rsmu_cdev *rsmu = file2rsmu(fptr);
+	int err = 0;
+
+	if (!rsmu->status_page || !READ_ONCE(status_period_ms))
+		return -ENODEV;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	down_read(&rsmu->remove_lock);
+	if (rsmu->removed)
+		err = -ENODEV;
+	else
+		err = vm_insert_page(vma, vma->vm_start, virt_to_page(rsmu->status_page));
+
+	if (!err) {
+		vma->vm_private_data = rsmu;
+		vma->vm_ops = &rsmu_status_vm_ops;
+		rsmu_status_vm_open(vma);
+	}
+	up_read(&rsmu->remove_lock);
+
+	return err;
+}
+
+static ssize_t
+rsmu_read(struct file *fptr, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct rsmu_client *client = fptr->private_data;
+	struct rsmu_cdev *rsmu = client->rsmu;
+	struct rsmu_event events[8];
+	unsigned int max;
+	unsigned int n;
+	int err;
+
+	if (READ_ONCE(rsmu->tdc_stream) == client)
+		return rsmu_tdc_read(client, fptr, buf, count);
+
+	max = min_t(size_t, count / sizeof(events[0]), ARRAY_SIZE(events));
+	if (!max)
+		return -EINVAL;
+
+	for (;;) {
+		spin_lock(&rsmu->client_lock);
+		n = kfifo_out(&client->events, events, max);
+		/* Report the overflow after the events that made it */
+		if (n < max && client->overflow) {
+			memset(&events[n], 0, sizeof(events[n]));
+			events[n].timestamp = ktime_get_raw_ns();
+			events[n].type = RSMU_EVENT_OVERFLOW;
+			client->overflow = false;
+			n++;
+		}
+		spin_unlock(&rsmu->client_lock);
+
+		if (n)
+			break;
+
+		if (READ_ONCE(rsmu->removed))
+			return -ENODEV;
+
+		if (fptr->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(rsmu->event_wait,
+					       rsmu_event_pending(client) ||
+					       READ_ONCE(rsmu->removed));
+		if (err)
+			return err;
+	}
+
+	if (copy_to_user(buf, events, n * sizeof(events[0])))
+		return -EFAULT;
+
+	return n * sizeof(events[0]);
+}
+
+static __poll_t rsmu_poll(struct file *fptr, poll_table *wait)
+{
+	struct rsmu_client *client = fptr->private_data;
+	struct rsmu_cdev *rsmu = client->rsmu;
+
+	poll_wait(fptr, &rsmu->event_wait, wait);
+
+	if (READ_ONCE(rsmu->removed))
+		return EPOLLHUP | EPOLLERR;
+
+	if (READ_ONCE(rsmu->tdc_stream) == client)
+		return kfifo_is_empty(&rsmu->tdc_ring) ? 0 : EPOLLIN | EPOLLRDNORM;
+
+	return rsmu_event_pending(client) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int rsmu_open(struct inode *inode, struct file *fptr)
+{
+	/* misc_open() points private_data at the miscdevice */
+	struct rsmu_cdev *rsmu = container_of(fptr->private_data, struct rsmu_cdev, miscdev);
+	struct rsmu_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+
+	client->rsmu = rsmu;
+	INIT_KFIFO(client->events);
+	kref_get(&rsmu->kref);
+
+	spin_lock(&rsmu->client_lock);
+	list_add_tail(&client->list, &rsmu->clients);
+	spin_unlock(&rsmu->client_lock);
+
+	fptr->private_data = client;
+
+	return 0;
+}
+
+static int rsmu_release(struct inode *inode, struct file *fptr)
+{
+	struct rsmu_client *client = fptr->private_data;
+	struct rsmu_cdev *rsmu = client->rsmu;
+
+	spin_lock(&rsmu->client_lock);
+	list_del(&client->list);
+	spin_unlock(&rsmu->client_lock);
+
+	if (client->mask.events)
+		rsmu_status_put(rsmu);
+
+	/* Remove stops the stream and the sampler itself */
+	down_read(&rsmu->remove_lock);
+	if (!rsmu->removed) {
+		if (READ_ONCE(rsmu->tdc_stream) == client)
+			rsmu_tdc_stream_stop(rsmu);
+		rsmu_alarm_stop(client);
+	}
+	up_read(&rsmu->remove_lock);
+
+	kfree(client);
+	kref_put(&rsmu->kref, rsmu_free);
+
+	return 0;
+}
+
+static long
+rsmu_ioctl(struct file *fptr, unsigned int cmd, unsigned long data)
+{
+	struct rsmu_cdev *rsmu = file2rsmu(fptr);
+	void __user *arg = (void __user *)data;
+	int err = 0;
+
+	/* Keep remove from tearing the device down under the ioctl */
+	down_read(&rsmu->remove_lock);
+	if (rsmu->removed) {
+		up_read(&rsmu->remove_lock);
+		return -ENODEV;
+	}
+
+	switch (cmd) {
+	case RSMU_SET_COMBOMODE:
+		err = rsmu_set_combomode(rsmu, arg);
+		break;
+	case RSMU_GET_STATE:
+		err = rsmu_get_dpll_state(rsmu, arg);
+		break;
+	case RSMU_GET_FFO:
+		err = rsmu_get_dpll_ffo(rsmu, arg);
+		break;
+	case RSMU_SET_HOLDOVER_MODE:
+		err = rsmu_set_holdover_mode(rsmu, arg);
+		break;
+	case RSMU_SET_OUTPUT_TDC_GO:
+		err = rsmu_set_output_tdc_go(rsmu, arg);
+		break;
+	case RSMU_GET_CURRENT_CLOCK_INDEX:
+		err = rsmu_get_clock_index(rsmu, arg);
+		break;
+	case RSMU_SET_CLOCK_PRIORITIES:
+		err = rsmu_set_clock_priorities(rsmu, arg);
+		break;
+	case RSMU_GET_REFERENCE_MONITOR_STATUS:
+		err = rsmu_get_reference_monitor_status(rsmu, arg);
+		break;
+	case RSMU_GET_TDC_MEAS:
+		err = rsmu_get_tdc_meas(rsmu, arg);
+		break;
+	case RSMU_GET_TDC_MEAS_BATCH:
+		err = rsmu_get_tdc_meas_batch(rsmu, arg);
+		break;
+	case RSMU_GET_STATUS_SNAPSHOT:
+		err = rsmu_get_status_snapshot(rsmu, arg);
+		break;
+	case RSMU_SET_EVENT_MASK:
+		err = rsmu_set_event_mask(fptr->private_data, arg);
+		break;
+	case RSMU_GET_STICKY_ALARMS:
+		err = rsmu_get_sticky_alarms(fptr->private_data, arg);
+		break;
+	case RSMU_SET_TDC_STREAM:
+		err = rsmu_set_tdc_stream(fptr->private_data, arg);
+		break;
+	case RSMU_GET_TDC_STATS:
+		err = rsmu_get_tdc_stats(rsmu, arg);
+		break;
+	case RSMU_GET_OUTPUT_TDC_MEAS:
+		err = rsmu_get_output_tdc_meas(rsmu, arg);
+		break;
+	case RSMU_GET_PHASE_TABLE:
+		err = rsmu_get_phase_table(rsmu, arg);
+		break;
+	case RSMU_SET_FAILOVER_POLICY:
+		err = rsmu_set_failover_policy(rsmu, arg);
+		break;
+	case RSMU_SET_HOLDOVER_HISTORY:
+		err = rsmu_set_holdover_history(rsmu, arg);
+		break;
+	case RSMU_BATCH:
+		err = rsmu_batch(rsmu, arg);
+		break;
+	case RSMU_REG_READ:
+		err = rsmu_reg_read(rsmu, arg);
+		break;
+	case RSMU_REG_WRITE:
+		err = rsmu_reg_write(rsmu, arg);
+		break;
+	case RSMU_REG_READV:
+		err = rsmu_reg_rwv(rsmu, arg, true);
+		break;
+	case RSMU_REG_WRITEV:
+		err = rsmu_reg_rwv(rsmu, arg, false);
+		break;
+	default:
+		/* Should not get here */
+		dev_err(rsmu->dev, "Undefined RSMU IOCTL");
+		err = -EINVAL;
+		break;
+	}
+
+	up_read(&rsmu->remove_lock);
+
+	return err;
+}
+
+static long rsmu_compat_ioctl(struct file *fptr, unsigned int cmd,
+			      unsigned long data)
+{
+	return rsmu_ioctl(fptr, cmd, data);
+}
+
+static const struct file_operations rsmu_fops = {
+	.owner = THIS_MODULE,
+	.open = rsmu_open,
+	.release = rsmu_release,
+	.read = rsmu_read,
+	.poll = rsmu_poll,
+	.unlocked_ioctl = rsmu_ioctl,
+	.compat_ioctl =	rsmu_compat_ioctl,
+	.mmap = rsmu_mmap,
+};
+
+static int rsmu_init_ops(struct rsmu_cdev *rsmu)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ops_array); i++)
+		if (ops_array[i]->type == rsmu->type)
+			break;
+
+	if (i == ARRAY_SIZE(ops_array))
+		return -EINVAL;
+
+	rsmu->ops = ops_array[i];
+	return 0;
+}
+
+static int
+rsmu_probe(struct platform_device *pdev)
+{
+	struct rsmu_ddata *ddata = dev_get_drvdata(pdev->dev.parent);
+	struct rsmu_cdev *rsmu;
+	int err;
+
+	/* Not devm, open files and mappings may hold on to it past remove */
+	rsmu = kzalloc(sizeof(*rsmu), GFP_KERNEL);
+	if (!rsmu)
+		return -ENOMEM;
+
+	kref_init(&rsmu->kref);
+	init_rwsem(&rsmu->remove_lock);
+
+	/* Save driver private data */
+	platform_set_drvdata(pdev, rsmu);
+
+	rsmu->dev = &pdev->dev;
+	rsmu->mfd = pdev->dev.parent;
+	rsmu->mfd_ddata = ddata;
+	rsmu->type = ddata->type;
+	rsmu->lock = &ddata->lock;
+	rsmu->regmap = ddata->regmap;
+	rsmu->index = ida_simple_get(&rsmu_cdev_map, 0, MINORMASK + 1, GFP_KERNEL);
+	if (rsmu->index < 0) {
+		dev_err(rsmu->dev, "Unable to get index %d\n", rsmu->index);
+		err = rsmu->index;
+		goto err_free;
+	}
+	snprintf(rsmu->name, sizeof(rsmu->name), "rsmu%d", rsmu->index);
+
+	err = rsmu_init_ops(rsmu);
+	if (err) {
+		dev_err(rsmu->dev, "Unknown SMU type %d", rsmu->type);
+		goto err_ida;
+	}
+
+	if (rsmu->ops->device_init) {
+		err = rsmu->ops->device_init(rsmu, firmware);
+		if (err) {
+			dev_err(rsmu->dev, "Device initialization failed\n");
+			goto err_ida;
+		}
+	}
+
+	if (rsmu->ops->get_status_snapshot) {
+		BUILD_BUG_ON(sizeof(struct rsmu_status_page) > PAGE_SIZE);
+		rsmu->status_page = (void *)get_zeroed_page(GFP_KERNEL);
+		if (!rsmu->status_page) {
+			err = -ENOMEM;
+			goto err_ida;
+		}
+		INIT_DELAYED_WORK(&rsmu->status_work, rsmu_status_work);
+	}
+
+	INIT_LIST_HEAD(&rsmu->clients);
+	spin_lock_init(&rsmu->client_lock);
+	init_waitqueue_head(&rsmu->event_wait);
+	INIT_DELAYED_WORK(&rsmu->tdc_work, rsmu_tdc_work);
+	mutex_init(&rsmu->tdc_ring_lock);
+
+	/* Initialize and register the miscdev */
+	rsmu->miscdev.minor = MISC_DYNAMIC_MINOR;
+	rsmu->miscdev.fops = &rsmu_fops;
+	rsmu->miscdev.name = rsmu->name;
+	err = misc_register(&rsmu->miscdev);
+	if (err) {
+		dev_err(rsmu->dev, "Unable to register device\n");
+		free_page((unsigned long)rsmu->status_page);
+		err = -ENODEV;
+		goto err_ida;
+	}
+
+	dev_info(rsmu->dev, "Probe %s successful\n", rsmu->name);
+	return 0;
+
+err_ida:
+	ida_simple_remove(&rsmu_cdev_map, rsmu->index);
+err_free:
+	kfree(rsmu);
+	return err;
+}
+
+static int
+rsmu_remove(struct platform_device *pdev)
+{
+	struct rsmu_cdev *rsmu = platform_get_drvdata(pdev);
+
+	misc_deregister(&rsmu->miscdev);
+
+	/* Stop new users of the device, then wait for those in flight */
+	spin_lock(&rsmu->client_lock);
+	rsmu->removed = true;
+	spin_unlock(&rsmu->client_lock);
+	wake_up_interruptible(&rsmu->event_wait);
+
+	down_write(&rsmu->remove_lock);
+	up_write(&rsmu->remove_lock);
+
+	mutex_lock(rsmu->lock);
+	rsmu->tdc_stats = false;
+	rsmu_tdc_drain_stop(rsmu);
+	mutex_unlock(rsmu->lock);
+	rsmu_tdc_stream_stop(rsmu);
+
+	if (rsmu->status_page) {
+		/* Nothing queues it once removed is set */
+		cancel_delayed_work_sync(&rsmu->status_work);
+		/* Live mappings keep their own reference to the page */
+		free_page((unsigned long)rsmu->status_page);
+	}
+
+	ida_simple_remove(&rsmu_cdev_map, rsmu->index);
+
+	/* Open files and mappings may still hold the rest */
+	kref_put(&rsmu->kref, rsmu_free);
 
 	return 0;
 }
@@ -8,13 +8,24 @@
 #ifndef __LINUX_RSMU_CDEV_H
 #define __LINUX_RSMU_CDEV_H
 
+#include <linux/atomic.h>
 #include <linux/firmware.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/list.h>
 #include <linux/miscdevice.h>
+#include <linux/mutex.h>
 #include <linux/regmap.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <uapi/linux/rsmu.h>
 #include <linux/bitfield.h>
 
 struct rsmu_ops;
+struct rsmu_ddata;
+struct rsmu_client;
 
 #define FW_NAME_LEN_MAX	256
 
@@ -56,11 +67,44 @@ enum holdover_mode {
 	HOLDOVER_MODE_MAX = HOLDOVER_MODE_MANUAL,
 };
 
+/**
+ * struct rsmu_failover - reference failover state of a DPLL
+ * @policy: policy set by RSMU_SET_FAILOVER_POLICY
+ * @active: candidates last programmed as priorities
+ * @num_active: number of @active candidates
+ * @applied: @active is programmed, clear when @policy changes
+ */
+struct rsmu_failover {
+	struct rsmu_failover_policy policy;
+	u8 active[RSMU_FAILOVER_MAX_CANDIDATES];
+	u8 num_active;
+	bool applied;
+};
+
+/**
+ * struct rsmu_ffo_history - FFO history of a DPLL
+ * @cfg: configuration set by RSMU_SET_HOLDOVER_HISTORY
+ * @entry: ring of decimated FFO samples, in ppqt
+ * @head: next @entry to write
+ * @count: valid entries in @entry
+ * @acc: sum of the samples of the entry being decimated
+ * @acc_count: samples in @acc
+ */
+struct rsmu_ffo_history {
+	struct rsmu_holdover_history cfg;
+	s64 entry[RSMU_FFO_HISTORY_LEN];
+	u32 head;
+	u32 count;
+	s64 acc;
+	u32 acc_count;
+};
+
 /**
  * struct rsmu_cdev - Driver data for RSMU character device
  * @name: rsmu device name as rsmu[index]
  * @dev: pointer to device
  * @mfd: pointer to MFD device
+ * @mfd_ddata: MFD device data, for batched register transactions
  * @miscdev: character device handle
  * @regmap: I2C/SPI regmap handle
  * @lock: mutex to protect operations from being interrupted
@@ -68,11 +112,50 @@ enum holdover_mode {
  * @ops: rsmu device methods
  * @ddata: device specific data
  * @index: rsmu device index
+ * @kref: held by the device, open files and mappings, which outlive remove
+ * @removed: the device is gone, set under @client_lock
+ * @remove_lock: held for reading by operations that reach the device, for
+ *	writing by remove to wait them out
+ * @status_page: status snapshot shared with user space through mmap
+ * @status_work: refreshes @status_page while it is mapped
+ * @status_users: number of mappings of @status_page, event subscribers and
+ *	other users of @status_work
+ * @status_prev: previous sample of @status_work, to detect changes
+ * @status_prev_valid: @status_prev holds a sample
+ * @tdc_ready_prev: TDC data was ready at the previous sample
+ * @clients: open files, for event delivery
+ * @client_lock: protects @clients and their event queues
+ * @event_wait: readers waiting for events
+ * @alarm_owner: file that started the alarm accumulator, NULL if stopped.
+ *	It owns the device sticky alarms, read and cleared at every sample
+ * @alarm_sampling: @alarm_owner holds a @status_users reference
+ * @alarm_level: RSMU_ALARM_* bits of each input at the last sample
+ * @alarm_latched: RSMU_ALARM_* bits of each input since the last read
+ * @alarm_count: assertions of each alarm of each input
+ * @alarm_since: time of the last read of @alarm_latched
+ * @tdc_stream: file reading the TDC stream, NULL if not streaming
+ * @tdc_stats: TDC statistics are collected, draining the FIFO too
+ * @tdc_draining: start_tdc_stream() ran for @tdc_stream or @tdc_stats, and
+ *	stop_tdc_stream() is due once neither is left
+ * @tdc_work: drains the TDC FIFO while streaming or collecting statistics,
+ *	into @tdc_ring for the former
+ * @tdc_period: @tdc_work period in jiffies
+ * @tdc_ring: streamed TDC samples
+ * @tdc_ring_buf: storage of @tdc_ring
+ * @tdc_ring_lock: protects @tdc_ring allocation against its reader and
+ *	serializes starting and stopping @tdc_work
+ * @tdc_samples: samples drained since streaming started
+ * @tdc_dropped: samples lost because @tdc_ring was full
+ * @tdc_overruns: times the TDC FIFO was found full
+ * @tdc_drop_pending: next queued sample follows dropped ones
+ * @failover: reference failover of each DPLL, protected by @lock
+ * @ffo_history: FFO history of each DPLL, protected by @lock
  */
 struct rsmu_cdev {
 	char name[16];
 	struct device *dev;
 	struct device *mfd;
+	struct rsmu_ddata *mfd_ddata;
 	struct miscdevice miscdev;
 	struct regmap *regmap;
 	struct mutex *lock;
@@ -80,6 +163,38 @@ struct rsmu_cdev {
 	struct rsmu_ops *ops;
 	void *ddata;
 	int index;
+	struct kref kref;
+	bool removed;
+	struct rw_semaphore remove_lock;
+	struct rsmu_status_page *status_page;
+	struct delayed_work status_work;
+	atomic_t status_users;
+	struct rsmu_status_snapshot status_prev;
+	bool status_prev_valid;
+	bool tdc_ready_prev;
+	struct list_head clients;
+	spinlock_t client_lock;
+	wait_queue_head_t event_wait;
+	struct rsmu_client *alarm_owner;
+	bool alarm_sampling;
+	u8 alarm_level[RSMU_MAX_INPUTS];
+	u8 alarm_latched[RSMU_MAX_INPUTS];
+	u32 alarm_count[RSMU_MAX_INPUTS][RSMU_NUM_ALARMS];
+	u64 alarm_since;
+	struct rsmu_client *tdc_stream;
+	bool tdc_stats;
+	bool tdc_draining;
+	struct delayed_work tdc_work;
+	unsigned long tdc_period;
+	DECLARE_KFIFO_PTR(tdc_ring, struct rsmu_tdc_sample);
+	void *tdc_ring_buf;
+	struct mutex tdc_ring_lock;
+	u64 tdc_samples;
+	u64 tdc_dropped;
+	u64 tdc_overruns;
+	bool tdc_drop_pending;
+	struct rsmu_failover failover[RSMU_MAX_DPLLS];
+	struct rsmu_ffo_history ffo_history[RSMU_MAX_DPLLS];
 };
 
 extern struct rsmu_ops cm_ops;
@@ -103,6 +218,21 @@ struct rsmu_ops {
 	int (*get_reference_monitor_status)(struct rsmu_cdev *rsmu, u8 clock_index,
 					    struct rsmu_reference_monitor_status_alarms *alarms);
 	int (*get_tdc_meas)(struct rsmu_cdev *rsmu, bool continuous, s64 *offset_ns);
+	int (*get_status_snapshot)(struct rsmu_cdev *rsmu,
+				   struct rsmu_status_snapshot *snapshot);
+	int (*get_tdc_ready)(struct rsmu_cdev *rsmu, bool *ready);
+	int (*read_clear_sticky_alarms)(struct rsmu_cdev *rsmu, u8 alarms[RSMU_MAX_INPUTS]);
+	int (*get_tdc_meas_batch)(struct rsmu_cdev *rsmu,
+				  struct rsmu_tdc_meas_batch *batch);
+	int (*start_tdc_stream)(struct rsmu_cdev *rsmu, u32 *drain_period_us);
+	int (*stop_tdc_stream)(struct rsmu_cdev *rsmu);
+	int (*drain_tdc_fifo)(struct rsmu_cdev *rsmu,
+			      struct rsmu_tdc_meas_batch *batch);
+	int (*get_tdc_stats)(struct rsmu_cdev *rsmu, struct rsmu_tdc_stats *stats);
+	int (*get_output_tdc_meas)(struct rsmu_cdev *rsmu,
+				   struct rsmu_output_tdc_meas *meas);
+	int (*get_phase_table)(struct rsmu_cdev *rsmu, struct rsmu_phase_table *table);
+	int (*set_holdover_ffo)(struct rsmu_cdev *rsmu, u8 dpll, s64 ffo);
 };
 
 /**
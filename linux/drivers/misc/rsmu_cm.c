@@ -6,8 +6,11 @@
  * Copyright (C) 2019 Integrated Device Technology, Inc., a Renesas Company.
  */
 #include <linux/kernel.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/device.h>
+#include <linux/slab.h>
 #include <linux/mfd/idt8a340_reg.h>
 #include <linux/mfd/rsmu.h>
 #include <asm/unaligned.h>
@@ -16,9 +19,25 @@
 
 #define FW_FILENAME	"rsmu8A34xxx.bin"
 #define FW_VERSION(rsmu)	(((struct rsmucm *)rsmu->ddata)->fw_version)
+#define TDC_BUSY(rsmu)	(((struct rsmucm *)rsmu->ddata)->tdc_busy)
+#define TDC_IDLE(rsmu)	(&((struct rsmucm *)rsmu->ddata)->tdc_idle)
+#define TDC_SEQ(rsmu)	(((struct rsmucm *)rsmu->ddata)->tdc_seq)
+#define TDC_GO_PREV(rsmu)	(((struct rsmucm *)rsmu->ddata)->tdc_go_prev)
+
+#define OUTPUT_TDC_POLL_US	(1000)
+#define OUTPUT_TDC_TIMEOUT_MS	(MSEC_PER_SEC)
+#define OUTPUT_TDC_IDLE_TIMEOUT_MS	(2 * OUTPUT_TDC_TIMEOUT_MS)
+#define OUTPUT_TDC_SAMPLE_US	(100 * USEC_PER_MSEC)
 
 struct rsmucm {
 	u8 fw_version;
+	/* An output TDC measurement is waited for with the device unlocked */
+	bool tdc_busy;
+	struct completion tdc_idle;
+	/* Number of output TDC 0 results sampled in the background so far */
+	u32 tdc_seq;
+	/* Go bit of output TDC 0 before the background sampling started */
+	u8 tdc_go_prev;
 };
 
 static int check_and_set_masks(struct rsmu_cdev *rsmu,
@@ -206,7 +225,7 @@ static int rsmu_cm_set_holdover_mode(struct rsmu_cdev *rsmu, u8 dpll, u8 enable,
 				 &reg, sizeof(reg));
 }
 
-static int rsmu_cm_set_output_tdc_go(struct rsmu_cdev *rsmu, u8 tdc, u8 enable)
+static int set_output_tdc_go(struct rsmu_cdev *rsmu, u8 tdc, u8 enable, u8 *prev)
 {
 	/* This function enables or disables output tdc alignment. */
 	u8 tdc_ctrl4_offset;
@@ -235,6 +254,11 @@ static int rsmu_cm_set_output_tdc_go(struct rsmu_cdev *rsmu, u8 tdc, u8 enable)
 
 	err = regmap_bulk_read(rsmu->regmap, tdc_n + tdc_ctrl4_offset,
 			       &reg, sizeof(reg));
+	if (err)
+		return err;
+
+	if (prev)
+		*prev = reg & 0x01;
 
 	if (enable)
 		reg |= 0x01;
@@ -245,37 +269,262 @@ static int rsmu_cm_set_output_tdc_go(struct rsmu_cdev *rsmu, u8 tdc, u8 enable)
 				 &reg, sizeof(reg));
 }
 
-static int rsmu_cm_get_dpll_state(struct rsmu_cdev *rsmu, u8 dpll, u8 *state)
+/* Sleep with the device unlocked, other TDC users wait in tdc_wait_idle() */
+static void tdc_sleep(struct rsmu_cdev *rsmu, unsigned long us)
+{
+	TDC_BUSY(rsmu) = true;
+	reinit_completion(TDC_IDLE(rsmu));
+	mutex_unlock(rsmu->lock);
+
+	usleep_range(us, us + us / 4);
+
+	mutex_lock(rsmu->lock);
+	TDC_BUSY(rsmu) = false;
+	complete_all(TDC_IDLE(rsmu));
+}
+
+static int tdc_wait_idle(struct rsmu_cdev *rsmu)
+{
+	unsigned long left;
+
+	while (TDC_BUSY(rsmu)) {
+		mutex_unlock(rsmu->lock);
+		left = wait_for_completion_timeout(TDC_IDLE(rsmu),
+						   msecs_to_jiffies(OUTPUT_TDC_IDLE_TIMEOUT_MS));
+		mutex_lock(rsmu->lock);
+
+		if (!left)
+			return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+static int rsmu_cm_set_output_tdc_go(struct rsmu_cdev *rsmu, u8 tdc, u8 enable)
 {
-	u8 reg;
 	int err;
 
-	/* 8 is sys dpll */
-	if (dpll > 8)
-		return -EINVAL;
+	/* Do not restart a TDC under a measurement being waited for */
+	err = tdc_wait_idle(rsmu);
+	if (err)
+		return err;
 
-	err = regmap_bulk_read(rsmu->regmap, STATUS + DPLL0_STATUS + dpll, &reg, sizeof(reg));
+	return set_output_tdc_go(rsmu, tdc, enable, NULL);
+}
+
+static s64 output_tdc_meas_to_ps(const u8 *buf)
+{
+	u64 meas = get_unaligned_le32(buf) | ((u64)get_unaligned_le16(&buf[4]) << 32);
+
+	return sign_extend64(meas, OUTPUT_TDC_MEAS_LEN * 8 - 1);
+}
+
+/* Wait for a measurement of an output TDC to be valid */
+static int wait_output_tdc(struct rsmu_cdev *rsmu, u8 tdc)
+{
+	ktime_t timeout = ktime_add_ms(ktime_get(), OUTPUT_TDC_TIMEOUT_MS);
+	u8 status;
+	int err;
+
+	while (1) {
+		err = regmap_bulk_read(rsmu->regmap, STATUS + OUTPUT_TDC0_STATUS + tdc,
+				       &status, sizeof(status));
+		if (err)
+			return err;
+
+		if (status & OUTPUT_TDC_MEAS_VALID)
+			return 0;
+
+		if (ktime_after(ktime_get(), timeout)) {
+			dev_err(rsmu->dev, "Output TDC measurement timeout");
+			return -ETIMEDOUT;
+		}
+
+		tdc_sleep(rsmu, OUTPUT_TDC_POLL_US);
+	}
+}
+
+static int rsmu_cm_get_tdc_meas(struct rsmu_cdev *rsmu, bool continuous, s64 *offset_ns)
+{
+	u8 buf[OUTPUT_TDC_MEAS_LEN];
+	int err;
+
+	err = tdc_wait_idle(rsmu);
+	if (err)
+		return err;
+
+	/* A one-shot measurement starts afresh, a continuous one keeps going */
+	if (!continuous) {
+		err = set_output_tdc_go(rsmu, 0, 0, NULL);
+		if (err)
+			return err;
+	}
+
+	err = set_output_tdc_go(rsmu, 0, 1, NULL);
 	if (err)
 		return err;
 
+	err = wait_output_tdc(rsmu, 0);
+	if (err)
+		return err;
+
+	err = regmap_bulk_read(rsmu->regmap, STATUS + OUTPUT_TDC0_MEASUREMENT,
+			       buf, sizeof(buf));
+	if (err)
+		return err;
+
+	if (!continuous) {
+		err = set_output_tdc_go(rsmu, 0, 0, NULL);
+		if (err)
+			return err;
+	}
+
+	*offset_ns = div_s64(output_tdc_meas_to_ps(buf), 1000);
+
+	return 0;
+}
+
+static int rsmu_cm_start_tdc_stream(struct rsmu_cdev *rsmu, u32 *drain_period_us)
+{
+	int err;
+
+	err = tdc_wait_idle(rsmu);
+	if (err)
+		return err;
+
+	err = set_output_tdc_go(rsmu, 0, 1, &TDC_GO_PREV(rsmu));
+	if (err)
+		return err;
+
+	*drain_period_us = OUTPUT_TDC_SAMPLE_US;
+
+	return 0;
+}
+
+static int rsmu_cm_stop_tdc_stream(struct rsmu_cdev *rsmu)
+{
+	return set_output_tdc_go(rsmu, 0, TDC_GO_PREV(rsmu), NULL);
+}
+
+/* STATUS from OUTPUT_TDC0_STATUS to the end of OUTPUT_TDC0_MEASUREMENT */
+#define OUTPUT_TDC0_LEN		(OUTPUT_TDC0_MEASUREMENT + OUTPUT_TDC_MEAS_LEN - \
+				 OUTPUT_TDC0_STATUS)
+
+/* There is no FIFO, so take the latest result of output TDC 0 as one sample */
+static int rsmu_cm_drain_tdc_fifo(struct rsmu_cdev *rsmu,
+				  struct rsmu_tdc_meas_batch *batch)
+{
+	struct rsmu_tdc_meas_sample *sample;
+	u8 buf[OUTPUT_TDC0_LEN];
+	int err;
+
+	if (!batch->max_samples)
+		return 0;
+
+	err = regmap_bulk_read(rsmu->regmap, STATUS + OUTPUT_TDC0_STATUS, buf, sizeof(buf));
+	if (err)
+		return err;
+
+	if (!(buf[0] & OUTPUT_TDC_MEAS_VALID))
+		return 0;
+
+	sample = &batch->samples[batch->num_samples++];
+	sample->offset = div_s64(output_tdc_meas_to_ps(&buf[OUTPUT_TDC0_MEASUREMENT -
+							     OUTPUT_TDC0_STATUS]), 1000);
+	sample->seq = ++TDC_SEQ(rsmu);
+
+	return 0;
+}
+
+/* STATUS from OUTPUT_TDC0_STATUS to the end of OUTPUT_TDC3_MEASUREMENT */
+#define OUTPUT_TDC_START	OUTPUT_TDC0_STATUS
+#define OUTPUT_TDC_LEN		(OUTPUT_TDC3_MEASUREMENT + OUTPUT_TDC_MEAS_LEN - \
+				 OUTPUT_TDC0_STATUS)
+
+static int rsmu_cm_get_output_tdc_meas(struct rsmu_cdev *rsmu,
+				       struct rsmu_output_tdc_meas *meas)
+{
+	u8 buf[OUTPUT_TDC_LEN];
+	u8 tdc;
+	int err;
+
+	err = regmap_bulk_read(rsmu->regmap, STATUS + OUTPUT_TDC_START, buf, sizeof(buf));
+	if (err)
+		return err;
+
+	for (tdc = 0; tdc < RSMU_MAX_OUTPUT_TDCS; tdc++) {
+		if (!(buf[OUTPUT_TDC0_STATUS + tdc - OUTPUT_TDC_START] & OUTPUT_TDC_MEAS_VALID))
+			continue;
+
+		meas->phase[tdc] = output_tdc_meas_to_ps(&buf[OUTPUT_TDC0_MEASUREMENT +
+						(OUTPUT_TDC1_MEASUREMENT - OUTPUT_TDC0_MEASUREMENT) *
+						tdc - OUTPUT_TDC_START]);
+		meas->valid |= BIT(tdc);
+	}
+
+	return 0;
+}
+
+static u8 dpll_status_to_state(u8 reg)
+{
 	switch (reg & DPLL_STATE_MASK) {
 	case DPLL_STATE_FREERUN:
-		*state = E_SRVLOUNQUALIFIEDSTATE;
-		break;
+		return E_SRVLOUNQUALIFIEDSTATE;
 	case DPLL_STATE_LOCKACQ:
 	case DPLL_STATE_LOCKREC:
-		*state = E_SRVLOLOCKACQSTATE;
-		break;
+		return E_SRVLOLOCKACQSTATE;
 	case DPLL_STATE_LOCKED:
-		*state = E_SRVLOTIMELOCKEDSTATE;
-		break;
+		return E_SRVLOTIMELOCKEDSTATE;
 	case DPLL_STATE_HOLDOVER:
-		*state = E_SRVLOHOLDOVERINSPECSTATE;
-		break;
+		return E_SRVLOHOLDOVERINSPECSTATE;
 	default:
-		*state = E_SRVLOSTATEINVALID;
-		break;
+		return E_SRVLOSTATEINVALID;
 	}
+}
+
+static s8 dpll_ref_status_to_clock_index(u8 reg)
+{
+	reg &= DPLL_REF_STATUS_MASK;
+
+	if (reg > (MAX_ELECTRICAL_REFERENCES - 1))
+		return -1;
+
+	return reg;
+}
+
+/* buf holds the 6-byte DPLLn_FILTER_STATUS frequency control word (FCW) */
+static s64 dpll_filter_status_to_ffo(const u8 *buf)
+{
+	s64 fcw;
+
+	fcw = sign_extend64(get_unaligned_le32(buf) |
+			    (u64)get_unaligned_le16(&buf[4]) << 32, 47);
+
+	/* FCW unit is 2 ^ -53 = 1.1102230246251565404236316680908e-16 */
+	return fcw * 111;
+}
+
+static void in_mon_status_to_alarms(u8 reg, struct rsmu_reference_monitor_status_alarms *alarms)
+{
+	alarms->los = (reg >> IN_MON_STATUS_LOS_SHIFT) & 1;
+	alarms->no_activity = (reg >> IN_MON_STATUS_NO_ACT_SHIFT) & 1;
+	alarms->frequency_offset_limit = (reg >> IN_MON_STATUS_FFO_LIMIT_SHIFT) & 1;
+}
+
+static int rsmu_cm_get_dpll_state(struct rsmu_cdev *rsmu, u8 dpll, u8 *state)
+{
+	u8 reg;
+	int err;
+
+	/* 8 is sys dpll */
+	if (dpll > 8)
+		return -EINVAL;
+
+	err = regmap_bulk_read(rsmu->regmap, STATUS + DPLL0_STATUS + dpll, &reg, sizeof(reg));
+	if (err)
+		return err;
+
+	*state = dpll_status_to_state(reg);
 
 	return 0;
 }
@@ -283,8 +532,7 @@ static int rsmu_cm_get_dpll_state(struct rsmu_cdev *rsmu, u8 dpll, u8 *state)
 static int rsmu_cm_get_dpll_ffo(struct rsmu_cdev *rsmu, u8 dpll,
 				struct rsmu_get_ffo *ffo)
 {
-	u8 buf[8] = {0};
-	s64 fcw = 0;
+	u8 buf[6];
 	u16 dpll_filter_status;
 	int err;
 
@@ -320,15 +568,11 @@ static int rsmu_cm_get_dpll_ffo(struct rsmu_cdev *rsmu, u8 dpll,
 		return -EINVAL;
 	}
 
-	err = regmap_bulk_read(rsmu->regmap, STATUS + dpll_filter_status, buf, 6);
+	err = regmap_bulk_read(rsmu->regmap, STATUS + dpll_filter_status, buf, sizeof(buf));
 	if (err)
 		return err;
 
-	/* Convert to frequency control word (FCW) */
-	fcw = sign_extend64(get_unaligned_le64(buf), 47);
-
-	/* FCW unit is 2 ^ -53 = 1.1102230246251565404236316680908e-16 */
-	ffo->ffo = fcw * 111;
+	ffo->ffo = dpll_filter_status_to_ffo(buf);
 
 	return 0;
 }
@@ -417,12 +661,7 @@ static int rsmu_cm_get_clock_index(struct rsmu_cdev *rsmu,
 	if (err)
 		return err;
 
-	reg &= DPLL_REF_STATUS_MASK;
-
-	if (reg > (MAX_ELECTRICAL_REFERENCES - 1))
-		*clock_index = -1;
-	else
-		*clock_index = reg;
+	*clock_index = dpll_ref_status_to_clock_index(reg);
 
 	return err;
 }
@@ -430,6 +669,8 @@ static int rsmu_cm_get_clock_index(struct rsmu_cdev *rsmu,
 static int rsmu_cm_set_clock_priorities(struct rsmu_cdev *rsmu, u8 dpll, u8 number_entries,
 				struct rsmu_priority_entry *priority_entry)
 {
+	u8 table[MAX_REF_PRIORITIES];
+	struct rsmu_txn *txn;
 	u32 dpll_reg_addr;
 	u8 dpll_mode_reg_off;
 	int priority_index;
@@ -449,6 +690,7 @@ static int rsmu_cm_set_clock_priorities(struct rsmu_cdev *rsmu, u8 dpll, u8 numb
 
 	dpll_mode_reg_off = IDTCM_FW_REG(FW_VERSION(rsmu), V520, DPLL_MODE);
 
+	/* Build the whole table first so a bad entry leaves the device alone */
 	for (priority_index = 0; priority_index < number_entries; priority_index++) {
 		if ((priority_entry->clock_index >= MAX_ELECTRICAL_REFERENCES) ||
 		    (priority_entry->priority >= MAX_REF_PRIORITIES))
@@ -470,36 +712,35 @@ static int rsmu_cm_set_clock_priorities(struct rsmu_cdev *rsmu, u8 dpll, u8 numb
 
 		prev_priority = priority_entry->priority;
 
-		reg = (1 << DPLL_REF_PRIORITY_ENABLE_SHIFT) |
+		table[priority_index] = (1 << DPLL_REF_PRIORITY_ENABLE_SHIFT) |
 			(priority_entry->clock_index << DPLL_REF_PRIORITY_REF_SHIFT) |
 			(current_priority_group << DPLL_REF_PRIORITY_GROUP_NUMBER_SHIFT);
 
-		err = regmap_bulk_write(rsmu->regmap, dpll_reg_addr + DPLL_REF_PRIORITY_0 +
-					priority_index, &reg, sizeof(reg));
-		if (err)
-			return err;
-
 		priority_entry++;
 	}
 
-	for (; priority_index < MAX_REF_PRIORITIES; priority_index++) {
-		reg = (0 << DPLL_REF_PRIORITY_ENABLE_SHIFT) |
+	for (; priority_index < MAX_REF_PRIORITIES; priority_index++)
+		table[priority_index] = (0 << DPLL_REF_PRIORITY_ENABLE_SHIFT) |
 			(0 << DPLL_REF_PRIORITY_REF_SHIFT) |
 			(DEFAULT_PRIORITY_GROUP << DPLL_REF_PRIORITY_GROUP_NUMBER_SHIFT);
 
-		err = regmap_bulk_write(rsmu->regmap, dpll_reg_addr + DPLL_REF_PRIORITY_0 +
-					priority_index, &reg, sizeof(reg));
-		if (err)
-			return err;
-	}
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
 
-	err = regmap_bulk_read(rsmu->regmap, dpll_reg_addr + dpll_mode_reg_off,
-			       &reg, sizeof(reg));
+	/* Write the table in one burst, then rewrite DPLL_MODE to switch over */
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+	rsmu_txn_write(txn, dpll_reg_addr + DPLL_REF_PRIORITY_0, table, sizeof(table));
+	rsmu_txn_read(txn, dpll_reg_addr + dpll_mode_reg_off, &reg, sizeof(reg));
+	err = rsmu_txn_commit(txn);
 	if (err)
-		return err;
+		goto out;
 
-	return regmap_bulk_write(rsmu->regmap, dpll_reg_addr + dpll_mode_reg_off,
-				 &reg, sizeof(reg));
+	rsmu_txn_write(txn, dpll_reg_addr + dpll_mode_reg_off, &reg, sizeof(reg));
+	err = rsmu_txn_commit(txn);
+out:
+	kfree(txn);
+	return err;
 }
 
 static int rsmu_cm_get_reference_monitor_status(struct rsmu_cdev *rsmu, u8 clock_index,
@@ -517,10 +758,154 @@ static int rsmu_cm_get_reference_monitor_status(struct rsmu_cdev *rsmu, u8 clock
 	if (err)
 		return err;
 
-	alarms->los = (reg >> IN_MON_STATUS_LOS_SHIFT) & 1;
-	alarms->no_activity = (reg >> IN_MON_STATUS_NO_ACT_SHIFT) & 1;
-	alarms->frequency_offset_limit = (reg >> IN_MON_STATUS_FFO_LIMIT_SHIFT) & 1;
+	in_mon_status_to_alarms(reg, alarms);
+
+	return err;
+}
+
+static int rsmu_cm_read_clear_sticky_alarms(struct rsmu_cdev *rsmu, u8 alarms[RSMU_MAX_INPUTS])
+{
+	u8 buf[MAX_ELECTRICAL_REFERENCES];
+	u8 clear = STICKY_STATUS_CLEAR_ALL;
+	struct rsmu_txn *txn;
+	u8 in;
+	int err;
+
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	/* Clear what was read within the same bus transfer */
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+	rsmu_txn_read(txn, STATUS + IN0_MON_STATUS, buf, sizeof(buf));
+	rsmu_txn_barrier(txn);
+	rsmu_txn_write(txn, STICKY_STATUS_CLEAR, &clear, sizeof(clear));
+	err = rsmu_txn_commit(txn);
+	kfree(txn);
+	if (err)
+		return err;
 
+	for (in = 0; in < MAX_ELECTRICAL_REFERENCES; in++)
+		alarms[in] = (((buf[in] >> IN_MON_STATUS_LOS_STICKY_SHIFT) & 1) ?
+			      RSMU_ALARM_LOS : 0) |
+			     (((buf[in] >> IN_MON_STATUS_NO_ACT_STICKY_SHIFT) & 1) ?
+			      RSMU_ALARM_NO_ACTIVITY : 0) |
+			     (((buf[in] >> IN_MON_STATUS_FFO_LIMIT_STICKY_SHIFT) & 1) ?
+			      RSMU_ALARM_FREQUENCY_OFFSET : 0);
+
+	return 0;
+}
+
+/* STATUS from IN0_MON_STATUS to the end of DPLLSYS_FILTER_STATUS */
+#define STATUS_SNAPSHOT_START	IN0_MON_STATUS
+#define STATUS_SNAPSHOT_LEN	(DPLLSYS_FILTER_STATUS + 6 - IN0_MON_STATUS)
+#define STATUS_SNAPSHOT(buf, reg)	(&(buf)[(reg) - STATUS_SNAPSHOT_START])
+
+static int rsmu_cm_get_status_snapshot(struct rsmu_cdev *rsmu,
+				       struct rsmu_status_snapshot *snapshot)
+{
+	u8 buf[STATUS_SNAPSHOT_LEN];
+	struct rsmu_txn *txn;
+	u8 dpll;
+	u8 in;
+	int err;
+
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	/* One burst, split at page boundaries by the transaction */
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+	rsmu_txn_read(txn, STATUS + STATUS_SNAPSHOT_START, buf, sizeof(buf));
+	err = rsmu_txn_commit(txn);
+	kfree(txn);
+	if (err)
+		return err;
+
+	/* DPLL 8 is the system DPLL, laid out right after DPLL 7 */
+	snapshot->num_dplls = 9;
+	snapshot->ffo_valid = GENMASK(8, 0);
+
+	for (dpll = 0; dpll < snapshot->num_dplls; dpll++) {
+		snapshot->state[dpll] =
+			dpll_status_to_state(*STATUS_SNAPSHOT(buf, DPLL0_STATUS + dpll));
+		snapshot->clock_index[dpll] =
+			dpll_ref_status_to_clock_index(*STATUS_SNAPSHOT(buf, DPLL0_REF_STATUS + dpll));
+		snapshot->ffo[dpll] =
+			dpll_filter_status_to_ffo(STATUS_SNAPSHOT(buf, DPLL0_FILTER_STATUS + 8 * dpll));
+	}
+
+	snapshot->num_inputs = MAX_ELECTRICAL_REFERENCES;
+
+	for (in = 0; in < snapshot->num_inputs; in++)
+		in_mon_status_to_alarms(*STATUS_SNAPSHOT(buf, IN0_MON_STATUS + in),
+					&snapshot->alarms[in]);
+
+	return 0;
+}
+
+/* STATUS from IN0_MON_STATUS to the end of DPLL7_PHASE_STATUS */
+#define PHASE_TABLE_START	IN0_MON_STATUS
+#define PHASE_TABLE_LEN		(DPLL7_PHASE_STATUS + 4 - IN0_MON_STATUS)
+#define PHASE_TABLE(buf, reg)	(&(buf)[(reg) - PHASE_TABLE_START])
+#define PHASE_TABLE_DPLLS	(8)
+
+static int rsmu_cm_get_phase_table(struct rsmu_cdev *rsmu, struct rsmu_phase_table *table)
+{
+	u8 mode[PHASE_TABLE_DPLLS];
+	u8 buf[PHASE_TABLE_LEN];
+	struct rsmu_dpll_phase *entry;
+	struct rsmu_txn *txn;
+	u32 dpll_reg_addr;
+	u8 dpll_mode_reg_off;
+	u8 in_mon;
+	u8 dpll;
+	s64 phase;
+	int err;
+
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	dpll_mode_reg_off = IDTCM_FW_REG(FW_VERSION(rsmu), V520, DPLL_MODE);
+
+	/* The status burst plus the mode of every DPLL, in one transaction */
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+	rsmu_txn_read(txn, STATUS + PHASE_TABLE_START, buf, sizeof(buf));
+	for (dpll = 0; dpll < PHASE_TABLE_DPLLS; dpll++) {
+		err = get_dpll_reg_offset(FW_VERSION(rsmu), dpll, &dpll_reg_addr);
+		if (err)
+			goto out;
+		rsmu_txn_read(txn, dpll_reg_addr + dpll_mode_reg_off, &mode[dpll], 1);
+	}
+	err = rsmu_txn_commit(txn);
+	if (err)
+		goto out;
+
+	table->num_dplls = PHASE_TABLE_DPLLS;
+
+	for (dpll = 0; dpll < PHASE_TABLE_DPLLS; dpll++) {
+		entry = &table->dpll[dpll];
+		entry->clock_index =
+			dpll_ref_status_to_clock_index(*PHASE_TABLE(buf, DPLL0_REF_STATUS + dpll));
+
+		if (((mode[dpll] >> PLL_MODE_SHIFT) & PLL_MODE_MASK) == PLL_MODE_PHASE_MEASUREMENT)
+			entry->flags |= RSMU_PHASE_MEASUREMENT;
+
+		if (entry->clock_index < 0)
+			continue;
+
+		phase = (s32)get_unaligned_le32(PHASE_TABLE(buf, DPLL0_PHASE_STATUS + 4 * dpll));
+		entry->phase = phase * DPLL_PHASE_STATUS_PS;
+		entry->flags |= RSMU_PHASE_VALID;
+
+		in_mon = *PHASE_TABLE(buf, IN0_MON_STATUS + entry->clock_index);
+		if (!(in_mon & (BIT(IN_MON_STATUS_LOS_SHIFT) | BIT(IN_MON_STATUS_NO_ACT_SHIFT) |
+				BIT(IN_MON_STATUS_FFO_LIMIT_SHIFT))))
+			entry->flags |= RSMU_PHASE_QUALIFIED;
+	}
+out:
+	kfree(txn);
 	return err;
 }
 
@@ -533,6 +918,7 @@ static int rsmu_cm_init(struct rsmu_cdev *rsmu, char fwname[FW_NAME_LEN_MAX])
 	if (!ddata)
 		return -ENOMEM;
 	rsmu->ddata = ddata;
+	init_completion(&ddata->tdc_idle);
 
 	err = load_firmware(rsmu, fwname);
 	if (err)
@@ -557,5 +943,13 @@ struct rsmu_ops cm_ops = {
 	.set_output_tdc_go = rsmu_cm_set_output_tdc_go,
 	.get_clock_index = rsmu_cm_get_clock_index,
 	.set_clock_priorities = rsmu_cm_set_clock_priorities,
-	.get_reference_monitor_status = rsmu_cm_get_reference_monitor_status
+	.get_reference_monitor_status = rsmu_cm_get_reference_monitor_status,
+	.get_tdc_meas = rsmu_cm_get_tdc_meas,
+	.start_tdc_stream = rsmu_cm_start_tdc_stream,
+	.stop_tdc_stream = rsmu_cm_stop_tdc_stream,
+	.drain_tdc_fifo = rsmu_cm_drain_tdc_fifo,
+	.get_status_snapshot = rsmu_cm_get_status_snapshot,
+	.read_clear_sticky_alarms = rsmu_cm_read_clear_sticky_alarms,
+	.get_output_tdc_meas = rsmu_cm_get_output_tdc_meas,
+	.get_phase_table = rsmu_cm_get_phase_table
 };
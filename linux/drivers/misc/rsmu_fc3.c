@@ -6,8 +6,13 @@
  * Copyright (C) 2023 Integrated Device Technology, Inc., a Renesas Company.
  */
 #include <linux/kernel.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
 #include <linux/mfd/idtRC38xxx_reg.h>
 #include <linux/mfd/rsmu.h>
 #include <asm/unaligned.h>
@@ -18,15 +23,47 @@
 #define DEVID(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->devid)
 #define HW_PARAM(rsmu)	(&((struct rsmufc3 *)rsmu->ddata)->hw_param)
 #define MEAS_MODE(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->meas_mode)
+#define MEAS_MODE_PREV(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->meas_mode_prev)
 #define TDC_APLL(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->tdc_apll_freq)
 #define TIME_REF(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->time_ref_freq)
+#define TDC_BUSY(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->tdc_busy)
+#define TDC_IDLE(rsmu)	(&((struct rsmufc3 *)rsmu->ddata)->tdc_idle)
+#define TDC_SEQ(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->tdc_seq)
+#define COARSE_SCALE(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->tdc_coarse_scale)
+#define FINE_SCALE(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->tdc_fine_scale)
+#define TDC_STATS(rsmu)	(&((struct rsmufc3 *)rsmu->ddata)->tdc_stats)
+#define TDC_STATS_ON(rsmu)	(((struct rsmufc3 *)rsmu->ddata)->tdc_stats_on)
+
+/* A FIFO read burst spans the read request, the entry and the FIFO status */
+#define TDC_FIFO_BURST_LEN	(TDC_FIFO_STS - TDC_FIFO_READ_REQ + 1)
+#define TDC_SCALE_SHIFT		(32)
+/* Keeps offsets in RSMU_TDC_STATS_FRAC_BITS fixed point within s64 */
+#define TDC_STATS_MAX_NS	(S64_MAX >> (RSMU_TDC_STATS_FRAC_BITS + 1))
+
+#define TDC_MEAS_TIMEOUT_MS	(5000)
+#define TDC_IDLE_TIMEOUT_MS	(2 * TDC_MEAS_TIMEOUT_MS)
+#define TDC_POLL_MIN_US		(100)
+#define TDC_POLL_MAX_US		(100 * USEC_PER_MSEC)
 
 struct rsmufc3 {
 	u8 devid;
 	u8 meas_mode;
+	/* Measurement mode before the background draining started */
+	u8 meas_mode_prev;
 	struct idtfc3_hw_param hw_param;
 	u32 tdc_apll_freq;
 	u32 time_ref_freq;
+	/* ns per coarse/fine TDC count, in TDC_SCALE_SHIFT fixed point */
+	u64 tdc_coarse_scale;
+	u64 tdc_fine_scale;
+	/* Number of TDC FIFO entries read so far */
+	u32 tdc_seq;
+	/* Continuous measurement statistics, see RSMU_GET_TDC_STATS */
+	struct rsmu_tdc_stats tdc_stats;
+	bool tdc_stats_on;
+	/* A TDC measurement is waited for with the device unlocked */
+	bool tdc_busy;
+	struct completion tdc_idle;
 };
 
 static int get_apll_reinit_reg_offset(u8 devid, u16 *apll_reinit_reg_offset)
@@ -115,6 +152,19 @@ static int rsmu_get_time_ref_freq(struct rsmu_cdev *rsmu)
 	return 0;
 }
 
+/* Convert the TDC clocks to scale factors once, rather than per measurement */
+static int rsmu_get_tdc_scales(struct rsmu_cdev *rsmu)
+{
+	if (!TIME_REF(rsmu) || !TDC_APLL(rsmu))
+		return -EINVAL;
+
+	COARSE_SCALE(rsmu) = div_u64((u64)NSEC_PER_SEC << TDC_SCALE_SHIFT, TIME_REF(rsmu));
+	FINE_SCALE(rsmu) = div64_u64((u64)NSEC_PER_SEC << TDC_SCALE_SHIFT,
+				     TDC_APLL(rsmu) * 62ULL);
+
+	return 0;
+}
+
 static int set_tdc_meas_mode(struct rsmu_cdev *rsmu, u8 meas_mode)
 {
 	int err;
@@ -167,56 +217,68 @@ static int hw_init(struct rsmu_cdev *rsmu)
 	if (err)
 		return err;
 
-	return rsmu_get_tdc_apll_freq(rsmu);
+	err = rsmu_get_tdc_apll_freq(rsmu);
+	if (err)
+		return err;
+
+	return rsmu_get_tdc_scales(rsmu);
 }
 
 static int hw_calibrate(struct rsmu_cdev *rsmu)
 {
 	int err = 0;
-	u8 val;
+	u8 val, apll_reinit;
 	u16 apll_reinit_reg_addr;
 	u8 apll_reinit_mask;
 	u8 devid = DEVID(rsmu);
+	struct rsmu_txn *txn;
 
 	err = get_apll_reinit_reg_offset(devid, &apll_reinit_reg_addr);
 	if (err)
 		return err;
 	apll_reinit_mask = IDTFC3_FW_FIELD(devid, VFC3A, APLL_REINIT);
 
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+
 	/*
 	 * Toggle TDC_DAC_RECAL_REQ:
 	 * (1) set tdc_en to 1
 	 * (2) set tdc_dac_recal_req to 0
 	 * (3) set tdc_dac_recal_req to 1
+	 * Each step is fenced off so the batch cannot reorder the toggle.
 	 */
 	if (devid == VFC3A) {
 		val = TDC_EN;
-		err = regmap_bulk_write(rsmu->regmap, TDC_ENABLE_CTRL,
-					&val, sizeof(val));
-		if (err)
-			return err;
+		rsmu_txn_write(txn, TDC_ENABLE_CTRL, &val, sizeof(val));
+		rsmu_txn_barrier(txn);
 		val = 0;
-		err = regmap_bulk_write(rsmu->regmap, TDC_DAC_CAL_CTRL,
-					&val, sizeof(val));
-		if (err)
-			return err;
+		rsmu_txn_write(txn, TDC_DAC_CAL_CTRL, &val, sizeof(val));
+		rsmu_txn_barrier(txn);
 		val = TDC_DAC_RECAL_REQ_VFC3A;
-		err = regmap_bulk_write(rsmu->regmap, TDC_DAC_CAL_CTRL,
-					&val, sizeof(val));
-		if (err)
-			return err;
+		rsmu_txn_write(txn, TDC_DAC_CAL_CTRL, &val, sizeof(val));
 	} else {
 		val = TDC_EN;
-		err = regmap_bulk_write(rsmu->regmap, TDC_CTRL,
-					&val, sizeof(val));
-		if (err)
-			return err;
+		rsmu_txn_write(txn, TDC_CTRL, &val, sizeof(val));
+		rsmu_txn_barrier(txn);
 		val = TDC_EN | TDC_DAC_RECAL_REQ;
-		err = regmap_bulk_write(rsmu->regmap, TDC_CTRL,
-					&val, sizeof(val));
-		if (err)
-			return err;
+		rsmu_txn_write(txn, TDC_CTRL, &val, sizeof(val));
 	}
+
+	/* Fetch APLL_REINIT for the next step in the same transfer */
+	rsmu_txn_barrier(txn);
+	rsmu_txn_read(txn, apll_reinit_reg_addr, &apll_reinit, sizeof(apll_reinit));
+
+	/* Runs at probe, without the device lock the transfer needs */
+	mutex_lock(rsmu->lock);
+	err = rsmu_txn_commit(txn);
+	mutex_unlock(rsmu->lock);
+	if (err)
+		goto out;
+
 	mdelay(10);
 
 	/*
@@ -224,18 +286,20 @@ static int hw_calibrate(struct rsmu_cdev *rsmu)
 	 * (1) set apll_reinit to 0
 	 * (2) set apll_reinit to 1
 	 */
-	err = regmap_bulk_read(rsmu->regmap, apll_reinit_reg_addr,
-			       &val, sizeof(val));
-	val &= ~apll_reinit_mask;
-	err = regmap_bulk_write(rsmu->regmap, apll_reinit_reg_addr,
-							&val, sizeof(val));
-	if (err)
-		return err;
+	val = apll_reinit & ~apll_reinit_mask;
+	rsmu_txn_write(txn, apll_reinit_reg_addr, &val, sizeof(val));
+	rsmu_txn_barrier(txn);
 	val |= apll_reinit_mask;
-	err = regmap_bulk_write(rsmu->regmap, apll_reinit_reg_addr,
-							&val, sizeof(val));
+	rsmu_txn_write(txn, apll_reinit_reg_addr, &val, sizeof(val));
+
+	mutex_lock(rsmu->lock);
+	err = rsmu_txn_commit(txn);
+	mutex_unlock(rsmu->lock);
+out:
+	kfree(txn);
 	if (err)
 		return err;
+
 	mdelay(10);
 
 	return hw_init(rsmu);
@@ -306,21 +370,28 @@ out:
 	return err;
 }
 
-static u8 clock_index_to_ref_index(struct rsmu_cdev *rsmu, u8 clock_index)
+static int read_ref_sel_cnfg(struct rsmu_cdev *rsmu, u32 *ref_sel_cnfg)
 {
-	u16 reg_addr;
-	u32 ref_sel_cnfg_reg;
-	u8 ref_index;
+	u8 buf[4];
 	int err;
-	u8 devid = DEVID(rsmu);
 
-	reg_addr = IDTFC3_FW_REG(devid, VFC3A, REF_SEL_CNFG);
-	err = regmap_bulk_read(rsmu->regmap, reg_addr, &ref_sel_cnfg_reg, sizeof(ref_sel_cnfg_reg));
+	err = regmap_bulk_read(rsmu->regmap, IDTFC3_FW_REG(DEVID(rsmu), VFC3A, REF_SEL_CNFG),
+			       buf, sizeof(buf));
 	if (err)
 		return err;
 
+	*ref_sel_cnfg = get_unaligned_le32(buf);
+
+	return 0;
+}
+
+/* Returns MAX_REF_INDEX + 1 if clock_index is not muxed to any reference */
+static u8 clock_index_to_ref_index(u32 ref_sel_cnfg, u8 clock_index)
+{
+	u8 ref_index;
+
 	for (ref_index = 0; ref_index <= MAX_REF_INDEX; ref_index++) {
-		if (clock_index == ((ref_sel_cnfg_reg >> (REF_MUX_SEL_SHIFT * ref_index)) &
+		if (clock_index == ((ref_sel_cnfg >> (REF_MUX_SEL_SHIFT * ref_index)) &
 				     REF_MUX_SEL_MASK))
 			return ref_index;
 	}
@@ -372,6 +443,14 @@ static int get_freqmon_sts_reg_offset(u8 devid, u8 ref_index, u16 *freqmon_sts_r
 	return 0;
 }
 
+/* Truncates toward zero, like the division it stands for */
+static inline s64 tdc_scale(s64 count, u64 scale)
+{
+	u64 ns = mul_u64_u64_shr(abs(count), scale, TDC_SCALE_SHIFT);
+
+	return count < 0 ? -(s64)ns : (s64)ns;
+}
+
 static inline s64 tdc_meas2offset(struct rsmu_cdev *rsmu, u64 meas_read)
 {
 	s64 coarse, fine;
@@ -379,35 +458,151 @@ static inline s64 tdc_meas2offset(struct rsmu_cdev *rsmu, u64 meas_read)
 	fine = sign_extend64(FIELD_GET(FINE_MEAS_MASK, meas_read), 12);
 	coarse = sign_extend64(FIELD_GET(COARSE_MEAS_MASK, meas_read), (39 - 13));
 
-	return div64_s64(coarse * NSEC_PER_SEC, TIME_REF(rsmu)) + div64_s64(
-			 fine * NSEC_PER_SEC, TDC_APLL(rsmu) * 62LL);
+	return tdc_scale(coarse, COARSE_SCALE(rsmu)) + tdc_scale(fine, FINE_SCALE(rsmu));
 }
 
-static inline int get_tdc_meas(struct rsmu_cdev *rsmu, s64 *offset_ns)
+static void tdc_stats_reset(struct rsmu_tdc_stats *stats, u32 hist_bin_ns,
+			    s64 hist_center_ns)
 {
-	u8 buf[9];
-	u8 val;
+	memset(stats, 0, sizeof(*stats));
+	stats->since = ktime_get_raw_ns();
+	stats->hist_bin_ns = hist_bin_ns;
+	stats->hist_center_ns = hist_center_ns;
+}
+
+/* Welford's running mean and sum of squared deviations, in fixed point */
+static void tdc_stats_add(struct rsmu_tdc_stats *stats, s64 offset_ns)
+{
+	s64 x, delta, d, bin;
+
+	offset_ns = clamp_t(s64, offset_ns, -TDC_STATS_MAX_NS, TDC_STATS_MAX_NS);
+	x = offset_ns * (1 << RSMU_TDC_STATS_FRAC_BITS);
+
+	stats->count++;
+	delta = x - stats->mean;
+	stats->mean += div64_s64(delta, stats->count);
+	/* delta and x - mean have the same sign, their product is >= 0 */
+	stats->m2 += mul_u64_u64_shr(abs(delta), abs(x - stats->mean),
+				     2 * RSMU_TDC_STATS_FRAC_BITS);
+
+	if (stats->count == 1 || offset_ns < stats->min)
+		stats->min = offset_ns;
+	if (stats->count == 1 || offset_ns > stats->max)
+		stats->max = offset_ns;
+
+	/* Round down, so that bins have the same width either side of 0 */
+	d = offset_ns - stats->hist_center_ns;
+	if (d >= 0)
+		bin = div_u64(d, stats->hist_bin_ns);
+	else
+		bin = -(s64)div_u64(-d + stats->hist_bin_ns - 1, stats->hist_bin_ns);
+	bin = clamp_t(s64, bin + RSMU_TDC_HIST_BINS / 2, 0, RSMU_TDC_HIST_BINS - 1);
+	stats->hist[bin]++;
+}
+
+/* Poll a few times per time reference period, which paces measurements */
+static unsigned long tdc_poll_interval_us(struct rsmu_cdev *rsmu)
+{
+	if (!TIME_REF(rsmu))
+		return TDC_POLL_MAX_US;
+
+	return clamp_t(unsigned long, USEC_PER_SEC / TIME_REF(rsmu) / 4,
+		       TDC_POLL_MIN_US, TDC_POLL_MAX_US);
+}
+
+/* Sleep with the device unlocked, other TDC users wait in tdc_wait_idle() */
+static void tdc_sleep(struct rsmu_cdev *rsmu, unsigned long us)
+{
+	TDC_BUSY(rsmu) = true;
+	reinit_completion(TDC_IDLE(rsmu));
+	mutex_unlock(rsmu->lock);
+
+	usleep_range(us, us + us / 4);
+
+	mutex_lock(rsmu->lock);
+	TDC_BUSY(rsmu) = false;
+	complete_all(TDC_IDLE(rsmu));
+}
+
+static int tdc_wait_idle(struct rsmu_cdev *rsmu)
+{
+	unsigned long left;
+
+	while (TDC_BUSY(rsmu)) {
+		mutex_unlock(rsmu->lock);
+		left = wait_for_completion_timeout(TDC_IDLE(rsmu),
+						   msecs_to_jiffies(TDC_IDLE_TIMEOUT_MS));
+		mutex_lock(rsmu->lock);
+
+		if (!left)
+			return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+/* Wait for a measurement to be done, returning the FIFO status then */
+static int wait_tdc_fifo(struct rsmu_cdev *rsmu, u8 *fifo_sts)
+{
+	unsigned long interval_us = tdc_poll_interval_us(rsmu);
+	ktime_t timeout = ktime_add_ms(ktime_get(), TDC_MEAS_TIMEOUT_MS);
 	int err;
 
-	/* Waiting for measurement to be done */
-	err = read_poll_timeout_atomic(regmap_bulk_read, err, !(val & FIFO_EMPTY),
-				       0, 5 * USEC_PER_SEC, false, rsmu->regmap,
-				       TDC_FIFO_STS, &val, sizeof(val));
-	if (err) {
-		dev_err(rsmu->dev, "TDC measurement timeout !!!");
-		return err;
+	while (1) {
+		err = regmap_bulk_read(rsmu->regmap, TDC_FIFO_STS,
+				       fifo_sts, sizeof(*fifo_sts));
+		if (err)
+			return err;
+
+		if (!(*fifo_sts & FIFO_EMPTY))
+			return 0;
+
+		if (ktime_after(ktime_get(), timeout)) {
+			dev_err(rsmu->dev, "TDC measurement timeout !!!");
+			return -ETIMEDOUT;
+		}
+
+		tdc_sleep(rsmu, interval_us);
 	}
+}
+
+/*
+ * Pop one FIFO entry. The burst runs on to TDC_FIFO_STS, so the status
+ * after the pop comes with the entry instead of needing its own read.
+ */
+static int pop_tdc_fifo(struct rsmu_cdev *rsmu, s64 *offset_ns, u8 *fifo_sts)
+{
+	u8 buf[TDC_FIFO_BURST_LEN];
+	int err;
 
 	err = regmap_bulk_read(rsmu->regmap, TDC_FIFO_READ_REQ,
 			       &buf, sizeof(buf));
 	if (err)
 		return err;
 
-	*offset_ns = tdc_meas2offset(rsmu, get_unaligned_le64(&buf[1]));
+	*offset_ns = tdc_meas2offset(rsmu, get_unaligned_le64(&buf[TDC_FIFO_READ -
+								   TDC_FIFO_READ_REQ]));
+	*fifo_sts = buf[TDC_FIFO_STS - TDC_FIFO_READ_REQ];
+	TDC_SEQ(rsmu)++;
+
+	if (TDC_STATS_ON(rsmu) && MEAS_MODE(rsmu) == CONTINUOUS)
+		tdc_stats_add(TDC_STATS(rsmu), *offset_ns);
 
 	return 0;
 }
 
+static inline int get_tdc_meas(struct rsmu_cdev *rsmu, s64 *offset_ns)
+{
+	u8 val;
+	int err;
+
+	err = wait_tdc_fifo(rsmu, &val);
+	if (err)
+		return err;
+
+	return pop_tdc_fifo(rsmu, offset_ns, &val);
+}
+
 static inline int check_tdc_fifo_overrun(struct rsmu_cdev *rsmu)
 {
 	u8 val;
@@ -454,6 +649,50 @@ static int get_tdc_meas_continuous(struct rsmu_cdev *rsmu, s64 *offset_ns)
 	return get_tdc_meas(rsmu, offset_ns);
 }
 
+static u8 dpll_sts_to_state(u8 dpll_sts)
+{
+	switch ((dpll_sts & DPLL_STATE_STS_MASK) >> DPLL_STATE_STS_SHIFT) {
+	case DPLL_STATE_FREERUN:
+	case DPLL_STATE_WRITE_FREQUENCY:
+		return E_SRVLOUNQUALIFIEDSTATE;
+	case DPLL_STATE_ACQUIRE:
+	case DPLL_STATE_HITLESS_SWITCH:
+		return E_SRVLOLOCKACQSTATE;
+	case DPLL_STATE_LOCKED:
+		return E_SRVLOTIMELOCKEDSTATE;
+	case DPLL_STATE_HOLDOVER:
+		return E_SRVLOHOLDOVERINSPECSTATE;
+	default:
+		return E_SRVLOSTATEINVALID;
+	}
+}
+
+/* The selected reference is only meaningful while the DPLL tracks one */
+static bool dpll_sts_has_ref(u8 dpll_sts)
+{
+	enum dpll_state state;
+
+	state = (enum dpll_state)((dpll_sts & DPLL_STATE_STS_MASK) >> DPLL_STATE_STS_SHIFT);
+
+	return (state == DPLL_STATE_LOCKED) || (state == DPLL_STATE_ACQUIRE) ||
+	       (state == DPLL_STATE_HITLESS_SWITCH);
+}
+
+static s8 dpll_sts_to_clock_index(u8 dpll_sts, u32 ref_sel_cnfg)
+{
+	u8 ref_index = (dpll_sts & DPLL_REF_SEL_STS_MASK) >> DPLL_REF_SEL_STS_SHIFT;
+
+	return (ref_sel_cnfg >> (REF_MUX_SEL_SHIFT * ref_index)) & REF_MUX_SEL_MASK;
+}
+
+static void monitor_sts_to_alarms(u8 los_reg, u32 freq_reg,
+				  struct rsmu_reference_monitor_status_alarms *alarms)
+{
+	alarms->los = los_reg & LOS_STS_MASK;
+	alarms->no_activity = 0;
+	alarms->frequency_offset_limit = (freq_reg >> FREQ_FAIL_STS_SHIFT) & 1;
+}
+
 static int rsmu_fc3_get_dpll_state(struct rsmu_cdev *rsmu,
 				   u8 dpll,
 				   u8 *state)
@@ -476,27 +715,7 @@ static int rsmu_fc3_get_dpll_state(struct rsmu_cdev *rsmu,
 	if (err)
 		return err;
 
-	reg = (reg & DPLL_STATE_STS_MASK) >> DPLL_STATE_STS_SHIFT;
-
-	switch (reg) {
-	case DPLL_STATE_FREERUN:
-	case DPLL_STATE_WRITE_FREQUENCY:
-		*state = E_SRVLOUNQUALIFIEDSTATE;
-		break;
-	case DPLL_STATE_ACQUIRE:
-	case DPLL_STATE_HITLESS_SWITCH:
-		*state = E_SRVLOLOCKACQSTATE;
-		break;
-	case DPLL_STATE_LOCKED:
-		*state = E_SRVLOTIMELOCKEDSTATE;
-		break;
-	case DPLL_STATE_HOLDOVER:
-		*state = E_SRVLOHOLDOVERINSPECSTATE;
-		break;
-	default:
-		*state = E_SRVLOSTATEINVALID;
-		break;
-	}
+	*state = dpll_sts_to_state(reg);
 
 	return 0;
 }
@@ -508,8 +727,6 @@ static int rsmu_fc3_get_clock_index(struct rsmu_cdev *rsmu,
 	u16 reg_addr;
 	u8 dpll_sts_reg;
 	u32 ref_sel_cnfg_reg;
-	enum dpll_state dpll_state_sts;
-	u8 ref_index;
 	int err;
 	u8 devid = DEVID(rsmu);
 
@@ -528,20 +745,12 @@ static int rsmu_fc3_get_clock_index(struct rsmu_cdev *rsmu,
 	if (err)
 		return err;
 
-	dpll_state_sts = (enum dpll_state)((dpll_sts_reg & DPLL_STATE_STS_MASK) >>
-					   DPLL_STATE_STS_SHIFT);
-	if ((dpll_state_sts == DPLL_STATE_LOCKED) || (dpll_state_sts == DPLL_STATE_ACQUIRE) ||
-	    (dpll_state_sts == DPLL_STATE_HITLESS_SWITCH)) {
-		ref_index = (dpll_sts_reg & DPLL_REF_SEL_STS_MASK) >> DPLL_REF_SEL_STS_SHIFT;
-
-		reg_addr = IDTFC3_FW_REG(devid, VFC3A, REF_SEL_CNFG);
-		err = regmap_bulk_read(rsmu->regmap, reg_addr, &ref_sel_cnfg_reg,
-				       sizeof(ref_sel_cnfg_reg));
+	if (dpll_sts_has_ref(dpll_sts_reg)) {
+		err = read_ref_sel_cnfg(rsmu, &ref_sel_cnfg_reg);
 		if (err)
 			return err;
 
-		*clock_index = (ref_sel_cnfg_reg >> (REF_MUX_SEL_SHIFT * ref_index)) &
-						    REF_MUX_SEL_MASK;
+		*clock_index = dpll_sts_to_clock_index(dpll_sts_reg, ref_sel_cnfg_reg);
 	}
 
 	return err;
@@ -556,6 +765,7 @@ static int rsmu_fc3_set_clock_priorities(struct rsmu_cdev *rsmu, u8 dpll, u8 num
 	u8 ref_index;
 	u8 priority;
 	u8 buf[2] = {0};
+	u32 ref_sel_cnfg;
 	int err;
 	u16 reg_addr;
 	u8 devid = DEVID(rsmu);
@@ -579,6 +789,10 @@ static int rsmu_fc3_set_clock_priorities(struct rsmu_cdev *rsmu, u8 dpll, u8 num
 	 */
 	reg |= DPLL_REFX_PRIORITY_DISABLE_MASK;
 
+	err = read_ref_sel_cnfg(rsmu, &ref_sel_cnfg);
+	if (err)
+		return err;
+
 	for (priority_index = 0; priority_index < number_entries; priority_index++) {
 		clock_index = priority_entry->clock_index;
 		priority = priority_entry->priority;
@@ -586,7 +800,7 @@ static int rsmu_fc3_set_clock_priorities(struct rsmu_cdev *rsmu, u8 dpll, u8 num
 		if ((clock_index > MAX_INPUT_CLOCK_INDEX) || (priority >= MAX_NUM_REF_PRIORITY))
 			return -EINVAL;
 
-		ref_index = clock_index_to_ref_index(rsmu, clock_index);
+		ref_index = clock_index_to_ref_index(ref_sel_cnfg, clock_index);
 
 		/* Set clock priority disable bit to zero to enable it */
 		switch (ref_index) {
@@ -631,6 +845,7 @@ static int rsmu_fc3_get_reference_monitor_status(struct rsmu_cdev *rsmu, u8 cloc
 	u16 freqmon_sts_reg_addr;
 	u8 los_reg;
 	u8 buf[4] = {0};
+	u32 ref_sel_cnfg;
 	u32 freq_reg;
 	int err;
 	u8 devid = DEVID(rsmu);
@@ -638,7 +853,11 @@ static int rsmu_fc3_get_reference_monitor_status(struct rsmu_cdev *rsmu, u8 cloc
 	if (clock_index > MAX_INPUT_CLOCK_INDEX)
 		return -EINVAL;
 
-	ref_index = clock_index_to_ref_index(rsmu, clock_index);
+	err = read_ref_sel_cnfg(rsmu, &ref_sel_cnfg);
+	if (err)
+		return err;
+
+	ref_index = clock_index_to_ref_index(ref_sel_cnfg, clock_index);
 	if (ref_index > MAX_REF_INDEX)
 		return -EINVAL;
 
@@ -655,21 +874,83 @@ static int rsmu_fc3_get_reference_monitor_status(struct rsmu_cdev *rsmu, u8 cloc
 	if (err)
 		return err;
 
-	alarms->los = los_reg & LOS_STS_MASK;
-
-	alarms->no_activity = 0;
-
 	err = regmap_bulk_read(rsmu->regmap, freqmon_sts_reg_addr,
 			       &buf, sizeof(buf));
 	if (err)
 		return err;
 
 	freq_reg = get_unaligned_le32(buf);
-	alarms->frequency_offset_limit = (freq_reg >> FREQ_FAIL_STS_SHIFT) & 1;
+	monitor_sts_to_alarms(los_reg, freq_reg, alarms);
 
 	return err;
 }
 
+static int rsmu_fc3_get_status_snapshot(struct rsmu_cdev *rsmu,
+					struct rsmu_status_snapshot *snapshot)
+{
+	u8 num_dplls = IDTFC3_FW_MACRO(DEVID(rsmu), VFC3A, MAX_DPLL_INDEX) + 1;
+	u8 los[MAX_REF_INDEX + 1];
+	u8 freq[MAX_REF_INDEX + 1][4];
+	u8 dpll_sts[MAX_DPLL_INDEX + 1];
+	u8 ref_sel_cnfg[4];
+	struct rsmu_txn *txn;
+	u8 devid = DEVID(rsmu);
+	u16 reg_addr;
+	u8 ref_index;
+	u8 dpll;
+	u8 in;
+	int err;
+
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+	rsmu_txn_read(txn, IDTFC3_FW_REG(devid, VFC3A, REF_SEL_CNFG),
+		      ref_sel_cnfg, sizeof(ref_sel_cnfg));
+
+	reg_addr = IDTFC3_FW_REG(devid, VFC3A, DPLL_STS);
+	for (dpll = 0; dpll < num_dplls; dpll++)
+		rsmu_txn_read(txn, reg_addr + dpll * 0x100, &dpll_sts[dpll], 1);
+
+	for (ref_index = 0; ref_index <= MAX_REF_INDEX; ref_index++) {
+		get_losmon_sts_reg_offset(devid, ref_index, &reg_addr);
+		rsmu_txn_read(txn, reg_addr, &los[ref_index], 1);
+		get_freqmon_sts_reg_offset(devid, ref_index, &reg_addr);
+		rsmu_txn_read(txn, reg_addr, freq[ref_index], sizeof(freq[ref_index]));
+	}
+
+	err = rsmu_txn_commit(txn);
+	kfree(txn);
+	if (err)
+		return err;
+
+	snapshot->num_dplls = num_dplls;
+
+	for (dpll = 0; dpll < num_dplls; dpll++) {
+		snapshot->state[dpll] = dpll_sts_to_state(dpll_sts[dpll]);
+		snapshot->clock_index[dpll] = -1;
+		if (dpll_sts_has_ref(dpll_sts[dpll]))
+			snapshot->clock_index[dpll] =
+				dpll_sts_to_clock_index(dpll_sts[dpll],
+							get_unaligned_le32(ref_sel_cnfg));
+	}
+
+	/* Inputs not muxed to a reference are not monitored */
+	snapshot->num_inputs = MAX_INPUT_CLOCK_INDEX + 1;
+
+	for (in = 0; in < snapshot->num_inputs; in++) {
+		ref_index = clock_index_to_ref_index(get_unaligned_le32(ref_sel_cnfg), in);
+		if (ref_index > MAX_REF_INDEX)
+			continue;
+
+		monitor_sts_to_alarms(los[ref_index], get_unaligned_le32(freq[ref_index]),
+				      &snapshot->alarms[in]);
+	}
+
+	return 0;
+}
+
 static int rsmu_fc3_get_tdc_meas(struct rsmu_cdev *rsmu, bool continuous, s64 *offset_ns)
 {
 	int err;
@@ -678,6 +959,10 @@ static int rsmu_fc3_get_tdc_meas(struct rsmu_cdev *rsmu, bool continuous, s64 *o
 	if (DEVID(rsmu) == VFC3A)
 		return -EOPNOTSUPP;
 
+	err = tdc_wait_idle(rsmu);
+	if (err)
+		return err;
+
 	if (continuous)
 		mode = CONTINUOUS;
 
@@ -693,6 +978,171 @@ static int rsmu_fc3_get_tdc_meas(struct rsmu_cdev *rsmu, bool continuous, s64 *o
 	return err;
 }
 
+/* Take what is queued in the FIFO without waiting, CONTINUOUS mode only */
+static int drain_tdc_fifo(struct rsmu_cdev *rsmu, struct rsmu_tdc_meas_batch *batch,
+			  u32 max_samples, u8 fifo_sts)
+{
+	struct rsmu_tdc_meas_sample *sample;
+	int err;
+
+	/* Draining the FIFO makes room again, so no need to restart the TDC */
+	if (fifo_sts & FIFO_FULL)
+		batch->flags |= RSMU_TDC_MEAS_OVERRUN;
+
+	while (batch->num_samples < max_samples && !(fifo_sts & FIFO_EMPTY)) {
+		sample = &batch->samples[batch->num_samples];
+
+		err = pop_tdc_fifo(rsmu, &sample->offset, &fifo_sts);
+		if (err)
+			return err;
+
+		sample->seq = TDC_SEQ(rsmu);
+		batch->num_samples++;
+	}
+
+	return 0;
+}
+
+static int rsmu_fc3_get_tdc_meas_batch(struct rsmu_cdev *rsmu,
+				       struct rsmu_tdc_meas_batch *batch)
+{
+	u32 max_samples;
+	u8 val;
+	int err;
+
+	if (DEVID(rsmu) == VFC3A)
+		return -EOPNOTSUPP;
+
+	max_samples = min_t(u32, batch->max_samples, TDC_FIFO_SIZE);
+	if (!max_samples)
+		return -EINVAL;
+
+	err = tdc_wait_idle(rsmu);
+	if (err)
+		return err;
+
+	err = set_tdc_meas_mode(rsmu, CONTINUOUS);
+	if (err)
+		return err;
+
+	/* Wait for the first entry only, then take whatever else is queued */
+	err = wait_tdc_fifo(rsmu, &val);
+	if (err)
+		return err;
+
+	return drain_tdc_fifo(rsmu, batch, max_samples, val);
+}
+
+static int rsmu_fc3_start_tdc_stream(struct rsmu_cdev *rsmu, u32 *drain_period_us)
+{
+	int err;
+
+	if (DEVID(rsmu) == VFC3A)
+		return -EOPNOTSUPP;
+
+	err = tdc_wait_idle(rsmu);
+	if (err)
+		return err;
+
+	MEAS_MODE_PREV(rsmu) = MEAS_MODE(rsmu);
+
+	err = set_tdc_meas_mode(rsmu, CONTINUOUS);
+	if (err)
+		return err;
+
+	/* Come back when the FIFO is half full, so a late drain still fits */
+	if (TIME_REF(rsmu))
+		*drain_period_us = clamp_t(u32, TDC_FIFO_SIZE / 2 * USEC_PER_SEC /
+					   TIME_REF(rsmu), TDC_POLL_MIN_US, USEC_PER_SEC);
+	else
+		*drain_period_us = TDC_POLL_MAX_US;
+
+	return 0;
+}
+
+static int rsmu_fc3_stop_tdc_stream(struct rsmu_cdev *rsmu)
+{
+	u8 mode = MEAS_MODE_PREV(rsmu);
+
+	/* Stopped unless it was measuring continuously before */
+	if (mode >= MEAS_MODE_INVALID)
+		mode = ONE_SHOT;
+
+	return set_tdc_meas_mode(rsmu, mode);
+}
+
+static int rsmu_fc3_drain_tdc_fifo(struct rsmu_cdev *rsmu,
+				   struct rsmu_tdc_meas_batch *batch)
+{
+	u8 val;
+	int err;
+
+	if (MEAS_MODE(rsmu) != CONTINUOUS)
+		return -EINVAL;
+
+	err = regmap_bulk_read(rsmu->regmap, TDC_FIFO_STS, &val, sizeof(val));
+	if (err)
+		return err;
+
+	return drain_tdc_fifo(rsmu, batch, min_t(u32, batch->max_samples, TDC_FIFO_SIZE),
+			      val);
+}
+
+static int rsmu_fc3_get_tdc_stats(struct rsmu_cdev *rsmu, struct rsmu_tdc_stats *stats)
+{
+	u32 flags = stats->flags;
+	u32 hist_bin_ns = stats->hist_bin_ns;
+	s64 hist_center_ns = stats->hist_center_ns;
+
+	if (DEVID(rsmu) == VFC3A)
+		return -EOPNOTSUPP;
+
+	/* Keep the histogram unless the caller gives a new one */
+	if (!hist_bin_ns) {
+		hist_bin_ns = TDC_STATS(rsmu)->hist_bin_ns ? : 1;
+		hist_center_ns = TDC_STATS(rsmu)->hist_center_ns;
+	}
+
+	if (!TDC_STATS_ON(rsmu) && !(flags & RSMU_TDC_STATS_STOP)) {
+		tdc_stats_reset(TDC_STATS(rsmu), hist_bin_ns, hist_center_ns);
+		TDC_STATS_ON(rsmu) = true;
+	}
+
+	*stats = *TDC_STATS(rsmu);
+	stats->flags = flags;
+	stats->timestamp = ktime_get_raw_ns();
+
+	if (flags & RSMU_TDC_STATS_STOP)
+		TDC_STATS_ON(rsmu) = false;
+	else if (flags & RSMU_TDC_STATS_RESET)
+		tdc_stats_reset(TDC_STATS(rsmu), hist_bin_ns, hist_center_ns);
+
+	return 0;
+}
+
+static int rsmu_fc3_get_tdc_ready(struct rsmu_cdev *rsmu, bool *ready)
+{
+	u8 val;
+	int err;
+
+	*ready = false;
+
+	if (DEVID(rsmu) == VFC3A)
+		return -EOPNOTSUPP;
+
+	/* One-shot measurements are read as soon as they complete */
+	if (MEAS_MODE(rsmu) != CONTINUOUS)
+		return 0;
+
+	err = regmap_bulk_read(rsmu->regmap, TDC_FIFO_STS, &val, sizeof(val));
+	if (err)
+		return err;
+
+	*ready = !(val & FIFO_EMPTY);
+
+	return 0;
+}
+
 static int rsmu_fc3_init(struct rsmu_cdev *rsmu, char fwname[FW_NAME_LEN_MAX])
 {
 	struct rsmufc3 *ddata;
@@ -702,6 +1152,7 @@ static int rsmu_fc3_init(struct rsmu_cdev *rsmu, char fwname[FW_NAME_LEN_MAX])
 	if (!ddata)
 		return -ENOMEM;
 	rsmu->ddata = ddata;
+	init_completion(&ddata->tdc_idle);
 
 	err = read_device_id(rsmu);
 	if (err) {
@@ -727,6 +1178,13 @@ struct rsmu_ops fc3_ops = {
 	.get_clock_index = rsmu_fc3_get_clock_index,
 	.set_clock_priorities = rsmu_fc3_set_clock_priorities,
 	.get_reference_monitor_status = rsmu_fc3_get_reference_monitor_status,
-	.get_tdc_meas = rsmu_fc3_get_tdc_meas
+	.get_tdc_meas = rsmu_fc3_get_tdc_meas,
+	.get_status_snapshot = rsmu_fc3_get_status_snapshot,
+	.get_tdc_ready = rsmu_fc3_get_tdc_ready,
+	.get_tdc_meas_batch = rsmu_fc3_get_tdc_meas_batch,
+	.start_tdc_stream = rsmu_fc3_start_tdc_stream,
+	.stop_tdc_stream = rsmu_fc3_stop_tdc_stream,
+	.drain_tdc_fifo = rsmu_fc3_drain_tdc_fifo,
+	.get_tdc_stats = rsmu_fc3_get_tdc_stats
 };
 
@@ -8,6 +8,7 @@
 #include <linux/kernel.h>
 #include <linux/errno.h>
 #include <linux/device.h>
+#include <linux/slab.h>
 #include <linux/mfd/idt82p33_reg.h>
 #include <linux/mfd/rsmu.h>
 #include <asm/unaligned.h>
@@ -17,6 +18,7 @@
 #define FW_FILENAME	"rsmu82p33xxx.bin"
 
 static u8 dpll_operating_mode_cnfg_prev[2] = {0xff, 0xff};
+static u8 dpll_holdover_mode_cnfg_msb_prev[2] = {0xff, 0xff};
 
 static int check_and_set_masks(struct rsmu_cdev *rsmu, u8 page, u8 offset, u8 val)
 {
@@ -182,11 +184,32 @@ static int set_dpll_oper_mode(struct rsmu_cdev *rsmu, u8 dpll, enum pll_mode mod
 }
 
 static int set_manual_holdover_mode(struct rsmu_cdev *rsmu, u8 dpll,
-				    enum holdover_mode mode)
+				    enum holdover_mode mode, bool save_prev)
 {
-	/* Set dpll{1:2}_man_holdover Bit 7 */
-	return rmw_reg_dpll_holdover_mode_cnfg_msb(rsmu, dpll, 0x80, 7,
-						   mode, NULL);
+	/* Set dpll{1:2}_man_holdover Bit 7, saving it only on entering holdover */
+	if (save_prev && dpll_holdover_mode_cnfg_msb_prev[dpll] == 0xff)
+		return rmw_reg_dpll_holdover_mode_cnfg_msb(rsmu, dpll, 0x80, 7, mode,
+							   &dpll_holdover_mode_cnfg_msb_prev[dpll]);
+	else
+		return rmw_reg_dpll_holdover_mode_cnfg_msb(rsmu, dpll, 0x80, 7, mode, NULL);
+}
+
+/* Restore dpll{1:2}_man_holdover as it was before holdover was forced */
+static int restore_manual_holdover_mode(struct rsmu_cdev *rsmu, u8 dpll)
+{
+	u8 prev = dpll_holdover_mode_cnfg_msb_prev[dpll];
+	int err;
+
+	if (prev == 0xff)
+		return 0;
+
+	err = set_manual_holdover_mode(rsmu, dpll, rsmu_get_bitfield(prev, 0x80, 7), false);
+	if (err)
+		return err;
+
+	dpll_holdover_mode_cnfg_msb_prev[dpll] = 0xff;
+
+	return 0;
 }
 
 static int rsmu_sabre_set_combomode(struct rsmu_cdev *rsmu, u8 dpll, u8 mode)
@@ -219,6 +242,45 @@ static int rsmu_sabre_set_combomode(struct rsmu_cdev *rsmu, u8 dpll, u8 mode)
 	return regmap_bulk_write(rsmu->regmap, dpll_ctrl_n, &cfg, sizeof(cfg));
 }
 
+static u8 operating_sts_to_state(u8 cfg)
+{
+	switch (cfg & OPERATING_STS_MASK) {
+	case DPLL_STATE_FREERUN:
+		return E_SRVLOUNQUALIFIEDSTATE;
+	case DPLL_STATE_PRELOCKED2:
+	case DPLL_STATE_PRELOCKED:
+		return E_SRVLOLOCKACQSTATE;
+	case DPLL_STATE_LOCKED:
+		return E_SRVLOTIMELOCKEDSTATE;
+	case DPLL_STATE_HOLDOVER:
+		return E_SRVLOHOLDOVERINSPECSTATE;
+	default:
+		return E_SRVLOSTATEINVALID;
+	}
+}
+
+/* buf holds the 5-byte DPLLn_HOLDOVER_FREQ_CNFG frequency control word */
+static s64 holdover_freq_to_ffo(const u8 *buf)
+{
+	s64 fcw;
+
+	fcw = sign_extend64(get_unaligned_le32(buf) | (u64)buf[4] << 32, 39);
+
+	/* FCW unit is 77760 / ( 1638400 * 2^48) = 1.68615121864946 * 10^-16 */
+	return div_s64(fcw * 2107689, 12500);
+}
+
+/* Inverse of holdover_freq_to_ffo */
+static void ffo_to_holdover_freq(s64 ffo, u8 *buf)
+{
+	s64 fcw;
+
+	fcw = clamp_t(s64, div_s64(ffo * 12500, 2107689), -BIT_ULL(39), BIT_ULL(39) - 1);
+
+	put_unaligned_le32(lower_32_bits(fcw), buf);
+	buf[4] = upper_32_bits(fcw);
+}
+
 static int rsmu_sabre_get_dpll_state(struct rsmu_cdev *rsmu, u8 dpll, u8 *state)
 {
 	u16 dpll_sts_n;
@@ -240,24 +302,7 @@ static int rsmu_sabre_get_dpll_state(struct rsmu_cdev *rsmu, u8 dpll, u8 *state)
 	if (err)
 		return err;
 
-	switch (cfg & OPERATING_STS_MASK) {
-	case DPLL_STATE_FREERUN:
-		*state = E_SRVLOUNQUALIFIEDSTATE;
-		break;
-	case DPLL_STATE_PRELOCKED2:
-	case DPLL_STATE_PRELOCKED:
-		*state = E_SRVLOLOCKACQSTATE;
-		break;
-	case DPLL_STATE_LOCKED:
-		*state = E_SRVLOTIMELOCKEDSTATE;
-		break;
-	case DPLL_STATE_HOLDOVER:
-		*state = E_SRVLOHOLDOVERINSPECSTATE;
-		break;
-	default:
-		*state = E_SRVLOSTATEINVALID;
-		break;
-	}
+	*state = operating_sts_to_state(cfg);
 
 	return 0;
 }
@@ -265,8 +310,7 @@ static int rsmu_sabre_get_dpll_state(struct rsmu_cdev *rsmu, u8 dpll, u8 *state)
 static int rsmu_sabre_get_dpll_ffo(struct rsmu_cdev *rsmu, u8 dpll,
 				   struct rsmu_get_ffo *ffo)
 {
-	u8 buf[8] = {0};
-	s64 fcw = 0;
+	u8 buf[5];
 	u16 dpll_freq_n;
 	int err;
 
@@ -286,15 +330,11 @@ static int rsmu_sabre_get_dpll_ffo(struct rsmu_cdev *rsmu, u8 dpll,
 		return -EINVAL;
 	}
 
-	err = regmap_bulk_read(rsmu->regmap, dpll_freq_n, buf, 5);
+	err = regmap_bulk_read(rsmu->regmap, dpll_freq_n, buf, sizeof(buf));
 	if (err)
 		return err;
 
-	/* Convert to frequency control word */
-	fcw = sign_extend64(get_unaligned_le64(buf), 39);
-
-	/* FCW unit is 77760 / ( 1638400 * 2^48) = 1.68615121864946 * 10^-16 */
-	ffo->ffo = div_s64(fcw * 2107689, 12500);
+	ffo->ffo = holdover_freq_to_ffo(buf);
 
 	return 0;
 }
@@ -308,7 +348,7 @@ static int rsmu_sabre_set_holdover_mode(struct rsmu_cdev *rsmu, u8 dpll, u8 enab
 		return -EINVAL;
 
 	if (enable) {
-		err = set_manual_holdover_mode(rsmu, dpll, (enum holdover_mode) mode);
+		err = set_manual_holdover_mode(rsmu, dpll, (enum holdover_mode) mode, true);
 		if (err)
 			return err;
 
@@ -321,15 +361,23 @@ static int rsmu_sabre_set_holdover_mode(struct rsmu_cdev *rsmu, u8 dpll, u8 enab
 			err = set_dpll_oper_mode(rsmu, dpll, PLL_MODE_DCO, false);
 			if (err)
 				return err;
-			err = set_manual_holdover_mode(rsmu, dpll, HOLDOVER_MODE_MANUAL);
+			err = set_manual_holdover_mode(rsmu, dpll, HOLDOVER_MODE_MANUAL, false);
+			/* DCO keeps manual holdover, so the saved setting is stale */
+			dpll_holdover_mode_cnfg_msb_prev[dpll] = 0xff;
 			break;
 
 		case PLL_MODE_WPH:
 			err = set_dpll_oper_mode(rsmu, dpll, PLL_MODE_WPH, false);
+			if (err)
+				return err;
+			err = restore_manual_holdover_mode(rsmu, dpll);
 			break;
 
 		case PLL_MODE_AUTOMATIC:
 			err = set_dpll_oper_mode(rsmu, dpll, PLL_MODE_AUTOMATIC, false);
+			if (err)
+				return err;
+			err = restore_manual_holdover_mode(rsmu, dpll);
 			break;
 
 		default:
@@ -342,6 +390,68 @@ static int rsmu_sabre_set_holdover_mode(struct rsmu_cdev *rsmu, u8 dpll, u8 enab
 	return err;
 }
 
+static int rsmu_sabre_set_holdover_ffo(struct rsmu_cdev *rsmu, u8 dpll, s64 ffo)
+{
+	u8 buf[5];
+	u16 dpll_freq_n;
+
+	/* Held while man_holdover is set, see rsmu_sabre_set_holdover_mode */
+	switch (dpll) {
+	case 0:
+		dpll_freq_n = DPLL1_HOLDOVER_FREQ_CNFG;
+		break;
+	case 1:
+		dpll_freq_n = DPLL2_HOLDOVER_FREQ_CNFG;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ffo_to_holdover_freq(ffo, buf);
+
+	return regmap_bulk_write(rsmu->regmap, dpll_freq_n, buf, sizeof(buf));
+}
+
+static int rsmu_sabre_get_status_snapshot(struct rsmu_cdev *rsmu,
+					  struct rsmu_status_snapshot *snapshot)
+{
+	static const u16 sts_reg[] = {DPLL1_OPERATING_STS, DPLL2_OPERATING_STS};
+	static const u16 freq_reg[] = {DPLL1_HOLDOVER_FREQ_CNFG, DPLL2_HOLDOVER_FREQ_CNFG};
+	u8 sts[ARRAY_SIZE(sts_reg)];
+	u8 freq[ARRAY_SIZE(freq_reg)][5];
+	struct rsmu_txn *txn;
+	u8 dpll;
+	int err;
+
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	rsmu_txn_init(txn, rsmu->mfd_ddata);
+	for (dpll = 0; dpll < ARRAY_SIZE(sts_reg); dpll++) {
+		rsmu_txn_read(txn, sts_reg[dpll], &sts[dpll], sizeof(sts[dpll]));
+		rsmu_txn_read(txn, freq_reg[dpll], freq[dpll], sizeof(freq[dpll]));
+	}
+	err = rsmu_txn_commit(txn);
+	kfree(txn);
+	if (err)
+		return err;
+
+	snapshot->num_dplls = ARRAY_SIZE(sts_reg);
+	snapshot->ffo_valid = GENMASK(snapshot->num_dplls - 1, 0);
+
+	for (dpll = 0; dpll < snapshot->num_dplls; dpll++) {
+		snapshot->state[dpll] = operating_sts_to_state(sts[dpll]);
+		snapshot->clock_index[dpll] = -1;
+		snapshot->ffo[dpll] = holdover_freq_to_ffo(freq[dpll]);
+	}
+
+	/* Reference monitoring is not supported */
+	snapshot->num_inputs = 0;
+
+	return 0;
+}
+
 static int rsmu_sabre_init(struct rsmu_cdev *rsmu, char fwname[FW_NAME_LEN_MAX])
 {
 	int err;
@@ -363,5 +473,7 @@ struct rsmu_ops sabre_ops = {
 	.set_output_tdc_go = NULL,
 	.get_clock_index = NULL,
 	.set_clock_priorities = NULL,
-	.get_reference_monitor_status = NULL
+	.get_reference_monitor_status = NULL,
+	.get_status_snapshot = rsmu_sabre_get_status_snapshot,
+	.set_holdover_ffo = rsmu_sabre_set_holdover_ffo
 };
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Running estimate of the bus latency of TOD writes, shared by the Renesas
+ * PTP hardware clock drivers.
+ *
+ * Copyright (C) 2026 Integrated Device Technology, Inc., a Renesas Company.
+ */
+#ifndef PTP_BUS_LATENCY_H
+#define PTP_BUS_LATENCY_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+
+/* Samples per min-filter window; the estimate spans the last two windows */
+#define BUS_LATENCY_WINDOW	(16)
+/* log2 buckets: [2^n, 2^(n+1)) ns, the last one open ended (>= 8 ms) */
+#define BUS_LATENCY_HIST_BINS	(24)
+
+struct bus_latency {
+	/* Minimum over the current and previous window */
+	s64	estimate_ns;
+	s64	window_min_ns;
+	s64	prev_window_min_ns;
+	u32	window_count;
+	u64	samples;
+	u32	hist[BUS_LATENCY_HIST_BINS];
+};
+
+static inline void bus_latency_init(struct bus_latency *lat)
+{
+	memset(lat, 0, sizeof(*lat));
+	lat->prev_window_min_ns = S64_MAX;
+}
+
+/*
+ * Feed the time taken by one bus write. The minimum rejects samples stretched
+ * by preemption or bus contention, while the rolling windows let the estimate
+ * follow a change of bus speed within 2 * BUS_LATENCY_WINDOW writes.
+ */
+static inline void bus_latency_add(struct bus_latency *lat,
+				   ktime_t start, ktime_t stop)
+{
+	s64 ns = ktime_to_ns(ktime_sub(stop, start));
+
+	if (ns <= 0)
+		return;
+
+	lat->hist[min_t(u32, ilog2(ns), BUS_LATENCY_HIST_BINS - 1)]++;
+	lat->samples++;
+
+	if (lat->window_count == 0 || ns < lat->window_min_ns)
+		lat->window_min_ns = ns;
+
+	lat->estimate_ns = min(lat->window_min_ns, lat->prev_window_min_ns);
+
+	if (++lat->window_count == BUS_LATENCY_WINDOW) {
+		lat->prev_window_min_ns = lat->window_min_ns;
+		lat->window_count = 0;
+	}
+}
+
+static inline void bus_latency_show(struct seq_file *s,
+				    const struct bus_latency *lat)
+{
+	int i;
+
+	seq_printf(s, "estimate_ns: %lld\n", lat->estimate_ns);
+	seq_printf(s, "samples: %llu\n", lat->samples);
+
+	for (i = 0; i < BUS_LATENCY_HIST_BINS; i++) {
+		if (!lat->hist[i])
+			continue;
+
+		seq_printf(s, "%10llu ns: %u\n", 1ULL << i, lat->hist[i]);
+	}
+}
+
+#endif /* PTP_BUS_LATENCY_H */
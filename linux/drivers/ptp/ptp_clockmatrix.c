@@ -5,6 +5,7 @@
  *
  * Copyright (C) 2019 Integrated Device Technology, Inc., a Renesas Company.
  */
+#include <linux/debugfs.h>
 #include <linux/firmware.h>
 #include <linux/platform_device.h>
 #include <linux/module.h>
@@ -15,6 +16,7 @@
 #include <linux/timekeeping.h>
 #include <linux/string.h>
 #include <linux/of.h>
+#include <linux/slab.h>
 #include <linux/mfd/rsmu.h>
 #include <linux/mfd/idt8a340_reg.h>
 #include <asm/unaligned.h>
@@ -35,7 +37,13 @@ MODULE_LICENSE("GPL");
 static char *firmware;
 module_param(firmware, charp, 0);
 
+static u32 settime_pps_mask;
+module_param(settime_pps_mask, uint, 0);
+MODULE_PARM_DESC(settime_pps_mask,
+"bit mask of TODs whose settime/adjtime steps land on the internal TOD PPS");
+
 #define SETTIME_CORRECTION (0)
+#define SETTIME_PPS_GUARD_MS (5)
 #define EXTTS_PERIOD_MS (95)
 
 static int _idtcm_adjfine(struct idtcm_channel *channel, long scaled_ppm);
@@ -58,6 +66,24 @@ static inline int idtcm_write(struct idtcm *idtcm,
 	return regmap_bulk_write(idtcm->regmap, module + regaddr, buf, count);
 }
 
+/* Every TOD write doubles as a sample for the bus latency estimate */
+static int idtcm_write_tod(struct idtcm *idtcm,
+			   u32 module,
+			   u32 regaddr,
+			   u8 *buf,
+			   u16 count)
+{
+	ktime_t start = ktime_get_raw();
+	int err;
+
+	err = idtcm_write(idtcm, module, regaddr, buf, count);
+	if (!err)
+		bus_latency_add(&idtcm->tod_write_latency, start,
+				ktime_get_raw());
+
+	return err;
+}
+
 static int contains_full_configuration(struct idtcm *idtcm,
 				       const struct firmware *fw)
 {
@@ -396,6 +422,81 @@ static void wait_for_chip_ready(struct idtcm *idtcm)
 			 "Continuing while SYS APLL/DPLL is not locked");
 }
 
+/*
+ * Sleep with idtcm->lock dropped so other channels and the cdev are not held
+ * off.  The channel stays marked busy until the lock is held again.
+ */
+static void idtcm_tod_sleep(struct idtcm_channel *channel, unsigned int ms)
+{
+	struct idtcm *idtcm = channel->idtcm;
+
+	channel->tod_busy = true;
+	reinit_completion(&channel->tod_idle);
+	mutex_unlock(idtcm->lock);
+
+	msleep(ms);
+
+	mutex_lock(idtcm->lock);
+	channel->tod_busy = false;
+	complete_all(&channel->tod_idle);
+}
+
+static int idtcm_wait_tod_write(struct idtcm_channel *channel, bool pps)
+{
+	struct idtcm *idtcm = channel->idtcm;
+	int err, count = 0;
+	u8 cmd;
+
+	while (1) {
+		err = idtcm_read(idtcm, channel->tod_write, TOD_WRITE_CMD,
+				 &cmd, sizeof(cmd));
+		if (err)
+			return err;
+
+		if ((cmd & TOD_WRITE_SELECTION_MASK) == 0)
+			break;
+
+		if (++count > 20) {
+			dev_err(idtcm->dev,
+				"Timed out waiting for the write counter");
+			return -EIO;
+		}
+
+		/* pps trigger takes up to 1 sec to complete */
+		if (pps)
+			idtcm_tod_sleep(channel, 50);
+	}
+
+	return 0;
+}
+
+/*
+ * Called with idtcm->lock held before touching the channel's TOD. Waits out
+ * a TOD write sleeping on the channel, then one still armed on TOD PPS.
+ */
+static int idtcm_wait_tod_idle(struct idtcm_channel *channel)
+{
+	struct idtcm *idtcm = channel->idtcm;
+	unsigned long left;
+
+	while (channel->tod_busy) {
+		mutex_unlock(idtcm->lock);
+		left = wait_for_completion_timeout(&channel->tod_idle,
+						   msecs_to_jiffies(TOD_IDLE_TIMEOUT_MS));
+		mutex_lock(idtcm->lock);
+
+		if (!left)
+			return -ETIMEDOUT;
+	}
+
+	if (!channel->tod_write_pending)
+		return 0;
+
+	channel->tod_write_pending = false;
+
+	return idtcm_wait_tod_write(channel, true);
+}
+
 static int _idtcm_gettime_triggered(struct idtcm_channel *channel,
 				    struct timespec64 *ts)
 {
@@ -491,6 +592,11 @@ static int _idtcm_gettime_immediate(struct idtcm_channel *channel,
 	u8 val = (SCSR_TOD_READ_TRIG_SEL_IMMEDIATE << TOD_READ_TRIGGER_SHIFT);
 	int err;
 
+	/* Don't read back the old TOD while a new one is armed */
+	err = idtcm_wait_tod_idle(channel);
+	if (err)
+		return err;
+
 	err = idtcm_write(idtcm, channel->tod_read_primary,
 			  tod_read_cmd, &val, sizeof(val));
 	if (err)
@@ -499,17 +605,24 @@ static int _idtcm_gettime_immediate(struct idtcm_channel *channel,
 	return _idtcm_gettime(channel, ts, 10);
 }
 
-static int _sync_pll_output(struct idtcm *idtcm,
+/*
+ * Queue the output sync sequence of one PLL. Spare registers are passed
+ * in as last read and updated, so no read is needed mid transaction.
+ */
+static int _sync_pll_output(struct rsmu_txn *txn,
 			    u8 pll,
 			    u8 sync_src,
 			    u8 qn,
-			    u8 qn_plus_1)
+			    u8 qn_plus_1,
+			    u8 *q8_spare,
+			    u8 *q11_spare)
 {
-	int err;
-	u8 val;
 	u32 sync_ctrl0;
 	u32 sync_ctrl1;
-	u8 temp;
+	u32 spare_reg = 0;
+	u8 *spare = NULL;
+	u8 spare_trig = 0;
+	u8 val;
 
 	if (qn == 0 && qn_plus_1 == 0)
 		return 0;
@@ -554,13 +667,8 @@ static int _sync_pll_output(struct idtcm *idtcm,
 	val = SYNCTRL1_MASTER_SYNC_RST;
 
 	/* Place master sync in reset */
-	err = idtcm_write(idtcm, sync_ctrl1, 0, &val, sizeof(val));
-	if (err)
-		return err;
-
-	err = idtcm_write(idtcm, sync_ctrl0, 0, &sync_src, sizeof(sync_src));
-	if (err)
-		return err;
+	rsmu_txn_write(txn, sync_ctrl1, &val, sizeof(val));
+	rsmu_txn_write(txn, sync_ctrl0, &sync_src, sizeof(sync_src));
 
 	/* Set sync trigger mask */
 	val |= SYNCTRL1_FBDIV_FRAME_SYNC_TRIG | SYNCTRL1_FBDIV_SYNC_TRIG;
@@ -571,91 +679,82 @@ static int _sync_pll_output(struct idtcm *idtcm,
 	if (qn_plus_1)
 		val |= SYNCTRL1_Q1_DIV_SYNC_TRIG;
 
-	err = idtcm_write(idtcm, sync_ctrl1, 0, &val, sizeof(val));
-	if (err)
-		return err;
+	rsmu_txn_write(txn, sync_ctrl1, &val, sizeof(val));
 
 	/* PLL5 can have OUT8 as second additional output. */
 	if (pll == 5 && qn_plus_1 != 0) {
-		err = idtcm_read(idtcm, HW_Q8_CTRL_SPARE, 0,
-				 &temp, sizeof(temp));
-		if (err)
-			return err;
-
-		temp &= ~(Q9_TO_Q8_SYNC_TRIG);
-
-		err = idtcm_write(idtcm, HW_Q8_CTRL_SPARE, 0,
-				  &temp, sizeof(temp));
-		if (err)
-			return err;
-
-		temp |= Q9_TO_Q8_SYNC_TRIG;
-
-		err = idtcm_write(idtcm, HW_Q8_CTRL_SPARE, 0,
-				  &temp, sizeof(temp));
-		if (err)
-			return err;
+		spare_reg = HW_Q8_CTRL_SPARE;
+		spare = q8_spare;
+		spare_trig = Q9_TO_Q8_SYNC_TRIG;
 	}
 
 	/* PLL6 can have OUT11 as second additional output. */
 	if (pll == 6 && qn_plus_1 != 0) {
-		err = idtcm_read(idtcm, HW_Q11_CTRL_SPARE, 0,
-				 &temp, sizeof(temp));
-		if (err)
-			return err;
+		spare_reg = HW_Q11_CTRL_SPARE;
+		spare = q11_spare;
+		spare_trig = Q10_TO_Q11_SYNC_TRIG;
+	}
 
-		temp &= ~(Q10_TO_Q11_SYNC_TRIG);
+	/* The spare register may sit on another page, keep it in sequence */
+	rsmu_txn_barrier(txn);
 
-		err = idtcm_write(idtcm, HW_Q11_CTRL_SPARE, 0,
-				  &temp, sizeof(temp));
-		if (err)
-			return err;
+	if (spare) {
+		*spare &= ~spare_trig;
+		rsmu_txn_write(txn, spare_reg, spare, sizeof(*spare));
 
-		temp |= Q10_TO_Q11_SYNC_TRIG;
+		*spare |= spare_trig;
+		rsmu_txn_write(txn, spare_reg, spare, sizeof(*spare));
 
-		err = idtcm_write(idtcm, HW_Q11_CTRL_SPARE, 0,
-				  &temp, sizeof(temp));
-		if (err)
-			return err;
+		rsmu_txn_barrier(txn);
 	}
 
 	/* Place master sync out of reset */
 	val &= ~(SYNCTRL1_MASTER_SYNC_RST);
-	err = idtcm_write(idtcm, sync_ctrl1, 0, &val, sizeof(val));
+	rsmu_txn_write(txn, sync_ctrl1, &val, sizeof(val));
 
-	return err;
+	rsmu_txn_barrier(txn);
+
+	return txn->err;
 }
 
 static int idtcm_sync_pps_output(struct idtcm_channel *channel)
 {
 	struct idtcm *idtcm = channel->idtcm;
+	struct rsmu_txn *txn;
 	u8 pll;
 	u8 qn;
 	u8 qn_plus_1;
 	int err = 0;
 	u8 out8_mux = 0;
 	u8 out11_mux = 0;
-	u8 temp;
+	u8 q8_spare;
+	u8 q11_spare;
 	u16 output_mask = channel->output_mask;
 
 	err = idtcm_read(idtcm, HW_Q8_CTRL_SPARE, 0,
-			 &temp, sizeof(temp));
+			 &q8_spare, sizeof(q8_spare));
 	if (err)
 		return err;
 
-	if ((temp & Q9_TO_Q8_FANOUT_AND_CLOCK_SYNC_ENABLE_MASK) ==
+	if ((q8_spare & Q9_TO_Q8_FANOUT_AND_CLOCK_SYNC_ENABLE_MASK) ==
 	    Q9_TO_Q8_FANOUT_AND_CLOCK_SYNC_ENABLE_MASK)
 		out8_mux = 1;
 
 	err = idtcm_read(idtcm, HW_Q11_CTRL_SPARE, 0,
-			 &temp, sizeof(temp));
+			 &q11_spare, sizeof(q11_spare));
 	if (err)
 		return err;
 
-	if ((temp & Q10_TO_Q11_FANOUT_AND_CLOCK_SYNC_ENABLE_MASK) ==
+	if ((q11_spare & Q10_TO_Q11_FANOUT_AND_CLOCK_SYNC_ENABLE_MASK) ==
 	    Q10_TO_Q11_FANOUT_AND_CLOCK_SYNC_ENABLE_MASK)
 		out11_mux = 1;
 
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
+
+	rsmu_txn_init(txn, idtcm->ddata);
+
 	for (pll = 0; pll < 8; pll++) {
 		qn = 0;
 		qn_plus_1 = 0;
@@ -692,14 +791,26 @@ static int idtcm_sync_pps_output(struct idtcm_channel *channel)
 			}
 		}
 
+		/* Flush before a PLL sequence could overflow the transaction */
+		if (txn->n_ops > RSMU_TXN_MAX_OPS - SYNC_PLL_OUTPUT_MAX_OPS) {
+			err = rsmu_txn_commit(txn);
+			if (err)
+				goto out;
+		}
+
 		if (qn != 0 || qn_plus_1 != 0)
-			err = _sync_pll_output(idtcm, pll, channel->sync_src,
-					       qn, qn_plus_1);
+			err = _sync_pll_output(txn, pll, channel->sync_src,
+					       qn, qn_plus_1,
+					       &q8_spare, &q11_spare);
 
 		if (err)
-			return err;
+			goto out;
 	}
 
+	err = rsmu_txn_commit(txn);
+out:
+	kfree(txn);
+
 	return err;
 }
 
@@ -733,8 +844,8 @@ static int _idtcm_set_dpll_hw_tod(struct idtcm_channel *channel,
 		if (err)
 			return err;
 
-		err = idtcm_write(idtcm, channel->hw_dpll_n,
-				  HW_DPLL_TOD_OVR__0, buf, sizeof(buf));
+		err = idtcm_write_tod(idtcm, channel->hw_dpll_n,
+				      HW_DPLL_TOD_OVR__0, buf, sizeof(buf));
 		if (err)
 			return err;
 	}
@@ -751,7 +862,7 @@ static int _idtcm_set_dpll_hw_tod(struct idtcm_channel *channel,
 			ktime_t diff = ktime_sub(ktime_get_raw(),
 						 idtcm->start_time);
 			total_overhead_ns =  ktime_to_ns(diff)
-					     + idtcm->tod_write_overhead_ns
+					     + idtcm->tod_write_latency.estimate_ns
 					     + SETTIME_CORRECTION;
 
 			timespec64_add_ns(&local_ts, total_overhead_ns);
@@ -763,8 +874,8 @@ static int _idtcm_set_dpll_hw_tod(struct idtcm_channel *channel,
 		if (err)
 			return err;
 
-		err = idtcm_write(idtcm, channel->hw_dpll_n,
-				  HW_DPLL_TOD_OVR__0, buf, sizeof(buf));
+		err = idtcm_write_tod(idtcm, channel->hw_dpll_n,
+				      HW_DPLL_TOD_OVR__0, buf, sizeof(buf));
 	}
 
 	return err;
@@ -778,16 +889,21 @@ static int _idtcm_set_dpll_scsr_tod(struct idtcm_channel *channel,
 	struct idtcm *idtcm = channel->idtcm;
 	unsigned char buf[TOD_BYTE_COUNT], cmd;
 	struct timespec64 local_ts = *ts;
-	int err, count = 0;
+	int err;
 
-	timespec64_add_ns(&local_ts, SETTIME_CORRECTION);
+	err = idtcm_wait_tod_idle(channel);
+	if (err)
+		return err;
+
+	if (wr_trig == SCSR_TOD_WR_TRIG_SEL_IMMEDIATE)
+		timespec64_add_ns(&local_ts, SETTIME_CORRECTION);
 
 	err = timespec_to_char_array(&local_ts, buf, sizeof(buf));
 	if (err)
 		return err;
 
-	err = idtcm_write(idtcm, channel->tod_write, TOD_WRITE,
-			  buf, sizeof(buf));
+	err = idtcm_write_tod(idtcm, channel->tod_write, TOD_WRITE,
+			      buf, sizeof(buf));
 	if (err)
 		return err;
 
@@ -807,28 +923,16 @@ static int _idtcm_set_dpll_scsr_tod(struct idtcm_channel *channel,
 	if (err)
 		return err;
 
-	/* Wait for the operation to complete. */
-	while (1) {
-		/* pps trigger takes up to 1 sec to complete */
-		if (wr_trig == SCSR_TOD_WR_TRIG_SEL_TODPPS)
-			msleep(50);
-
-		err = idtcm_read(idtcm, channel->tod_write, TOD_WRITE_CMD,
-				 &cmd, sizeof(cmd));
-		if (err)
-			return err;
-
-		if ((cmd & TOD_WRITE_SELECTION_MASK) == 0)
-			break;
-
-		if (++count > 20) {
-			dev_err(idtcm->dev,
-				"Timed out waiting for the write counter");
-			return -EIO;
-		}
+	/*
+	 * Don't hold the caller for up to a second on a pps triggered write;
+	 * the next user of this TOD waits for it in idtcm_wait_tod_idle().
+	 */
+	if (wr_trig == SCSR_TOD_WR_TRIG_SEL_TODPPS) {
+		channel->tod_write_pending = true;
+		return 0;
 	}
 
-	return 0;
+	return idtcm_wait_tod_write(channel, false);
 }
 
 static int get_output_base_addr(enum fw_version ver, u8 outn)
@@ -895,10 +999,51 @@ static int _idtcm_settime_deprecated(struct idtcm_channel *channel,
 	return idtcm_sync_pps_output(channel);
 }
 
+/*
+ * Write the TOD on the next internal TOD PPS. An absolute time is advanced by
+ * the time left to that edge, measured on the TOD itself, so the result does
+ * not depend on bus or scheduling latency.
+ */
+static int idtcm_settime_pps(struct idtcm_channel *channel,
+			     struct timespec64 const *ts,
+			     enum scsr_tod_write_type_sel wr_type)
+{
+	struct timespec64 local_ts = *ts;
+	struct timespec64 now;
+	s64 to_edge_ns;
+	int err;
+
+	if (wr_type != SCSR_TOD_WR_TYPE_SEL_ABSOLUTE)
+		return _idtcm_set_dpll_scsr_tod(channel, ts,
+						SCSR_TOD_WR_TRIG_SEL_TODPPS,
+						wr_type);
+
+	err = _idtcm_gettime_immediate(channel, &now);
+	if (err)
+		return err;
+
+	to_edge_ns = NSEC_PER_SEC - now.tv_nsec;
+
+	/* Too close to get the write in ahead of this edge, use the next */
+	if (to_edge_ns < SETTIME_PPS_GUARD_MS * NSEC_PER_MSEC) {
+		idtcm_tod_sleep(channel, SETTIME_PPS_GUARD_MS + 1);
+		to_edge_ns += NSEC_PER_SEC;
+	}
+
+	timespec64_add_ns(&local_ts, to_edge_ns);
+
+	return _idtcm_set_dpll_scsr_tod(channel, &local_ts,
+					SCSR_TOD_WR_TRIG_SEL_TODPPS,
+					SCSR_TOD_WR_TYPE_SEL_ABSOLUTE);
+}
+
 static int _idtcm_settime(struct idtcm_channel *channel,
 			  struct timespec64 const *ts,
 			  enum scsr_tod_write_type_sel wr_type)
 {
+	if (channel->settime_pps)
+		return idtcm_settime_pps(channel, ts, wr_type);
+
 	return _idtcm_set_dpll_scsr_tod(channel, ts,
 					SCSR_TOD_WR_TRIG_SEL_IMMEDIATE,
 					wr_type);
@@ -945,32 +1090,30 @@ static int idtcm_set_phase_pull_in_slope_limit(struct idtcm_channel *channel,
 	return err;
 }
 
-static int idtcm_start_phase_pull_in(struct idtcm_channel *channel)
+static int idtcm_read_phase_pull_in_ctrl(struct idtcm_channel *channel,
+					  u8 *ctrl)
 {
-	int err;
 	struct idtcm *idtcm = channel->idtcm;
-	u8 buf;
 
-	err = idtcm_read(idtcm, channel->dpll_phase_pull_in, PULL_IN_CTRL,
-			 &buf, sizeof(buf));
-	if (err)
-		return err;
+	return idtcm_read(idtcm, channel->dpll_phase_pull_in, PULL_IN_CTRL,
+			  ctrl, sizeof(*ctrl));
+}
 
-	if (buf == 0) {
-		buf = 0x01;
-		err = idtcm_write(idtcm, channel->dpll_phase_pull_in,
-				  PULL_IN_CTRL, &buf, sizeof(buf));
-	} else {
-		err = -EBUSY;
-	}
+static int idtcm_start_phase_pull_in(struct idtcm_channel *channel)
+{
+	struct idtcm *idtcm = channel->idtcm;
+	u8 buf = 0x01;
 
-	return err;
+	return idtcm_write(idtcm, channel->dpll_phase_pull_in,
+			   PULL_IN_CTRL, &buf, sizeof(buf));
 }
 
-static int do_phase_pull_in_fw(struct idtcm_channel *channel,
-			       s32 offset_ns,
-			       u32 max_ffo_ppb)
+static int _do_phase_pull_in_fw(struct idtcm_channel *channel,
+				s32 offset_ns,
+				u32 max_ffo_ppb)
 {
+	s64 duration_ms = 0;
+	s64 poll_ms;
 	int err;
 
 	err = idtcm_set_phase_pull_in_offset(channel, -offset_ns);
@@ -982,52 +1125,122 @@ static int do_phase_pull_in_fw(struct idtcm_channel *channel,
 		return err;
 
 	err = idtcm_start_phase_pull_in(channel);
+	if (err)
+		return err;
 
-	return err;
+	/* The firmware slews at the slope limit: |offset| ns at ppb (ns/s) */
+	if (max_ffo_ppb && !(max_ffo_ppb & 0xff000000))
+		duration_ms = div_u64((u64)abs(offset_ns) * MSEC_PER_SEC,
+				      max_ffo_ppb);
+
+	poll_ms = clamp_t(s64, duration_ms / 8, PHASE_PULL_IN_POLL_MIN_MS,
+			  PHASE_PULL_IN_POLL_MAX_MS);
+
+	channel->fw_phase_pull_in = true;
+	channel->fw_phase_pull_in_poll = msecs_to_jiffies(poll_ms);
+	channel->fw_phase_pull_in_errors = 0;
+	channel->phase_pull_in_end = ktime_add_ms(ktime_get(), duration_ms);
+
+	/* First look at PULL_IN_CTRL when the pull-in should be done */
+	ptp_schedule_worker(channel->ptp_clock, msecs_to_jiffies(duration_ms));
+
+	return 0;
 }
 
-static int set_tod_write_overhead(struct idtcm_channel *channel)
+static int do_phase_pull_in_fw(struct idtcm_channel *channel,
+			       s32 offset_ns,
+			       u32 max_ffo_ppb)
 {
-	struct idtcm *idtcm = channel->idtcm;
-	s64 current_ns = 0;
-	s64 lowest_ns = 0;
 	int err;
-	u8 i;
-	ktime_t start;
-	ktime_t stop;
-	ktime_t diff;
+	u8 ctrl;
 
-	char buf[TOD_BYTE_COUNT] = {0};
+	if (!channel->fw_phase_pull_in) {
+		err = idtcm_read_phase_pull_in_ctrl(channel, &ctrl);
+		if (err)
+			return err;
 
-	/* Set page offset */
-	idtcm_write(idtcm, channel->hw_dpll_n, HW_DPLL_TOD_OVR__0,
-		    buf, sizeof(buf));
+		if (ctrl == 0)
+			return _do_phase_pull_in_fw(channel, offset_ns,
+						    max_ffo_ppb);
+
+		/* Started outside our tracking, poll until it is done */
+		channel->fw_phase_pull_in = true;
+		channel->fw_phase_pull_in_poll =
+			msecs_to_jiffies(PHASE_PULL_IN_POLL_MIN_MS);
+		channel->fw_phase_pull_in_errors = 0;
+		channel->phase_pull_in_end = ktime_get();
+		ptp_schedule_worker(channel->ptp_clock,
+				    channel->fw_phase_pull_in_poll);
+	}
 
-	for (i = 0; i < TOD_WRITE_OVERHEAD_COUNT_MAX; i++) {
-		start = ktime_get_raw();
+	/*
+	 * Queue behind the running pull-in instead of failing with -EBUSY,
+	 * within the largest offset either adjtime hands to a pull-in
+	 */
+	channel->fw_phase_pull_in_queued_ns =
+		clamp_t(s64, channel->fw_phase_pull_in_queued_ns + offset_ns,
+			-PHASE_PULL_IN_THRESHOLD_NS_DEPRECATED,
+			PHASE_PULL_IN_THRESHOLD_NS_DEPRECATED);
+	channel->fw_phase_pull_in_queued_ffo_ppb = max_ffo_ppb;
+	channel->fw_phase_pull_in_queued = true;
 
-		err = idtcm_write(idtcm, channel->hw_dpll_n,
-				  HW_DPLL_TOD_OVR__0, buf, sizeof(buf));
-		if (err)
-			return err;
+	return 0;
+}
 
-		stop = ktime_get_raw();
+static long idtcm_check_fw_phase_pull_in(struct idtcm_channel *channel)
+{
+	struct idtcm *idtcm = channel->idtcm;
+	s32 offset_ns;
+	int err;
+	u8 ctrl;
 
-		diff = ktime_sub(stop, start);
+	err = idtcm_read_phase_pull_in_ctrl(channel, &ctrl);
+	if (err)
+		channel->fw_phase_pull_in_errors++;
+	else
+		channel->fw_phase_pull_in_errors = 0;
 
-		current_ns = ktime_to_ns(diff);
+	if (err || ctrl) {
+		/* Keep polling until well past the expected end */
+		if (channel->fw_phase_pull_in_errors < PHASE_PULL_IN_MAX_ERRORS &&
+		    ktime_before(ktime_get(),
+				 ktime_add_ms(channel->phase_pull_in_end,
+					      PHASE_PULL_IN_TIMEOUT_MS)))
+			return channel->fw_phase_pull_in_poll;
 
-		if (i == 0) {
-			lowest_ns = current_ns;
-		} else {
-			if (current_ns < lowest_ns)
-				lowest_ns = current_ns;
-		}
+		dev_warn(idtcm->dev,
+			 "Phase pull-in did not complete (%d), dropping %lld ns queued",
+			 err, channel->fw_phase_pull_in_queued_ns);
+
+		channel->fw_phase_pull_in = false;
+		channel->phase_pull_in_done = ktime_get();
+		channel->fw_phase_pull_in_queued_ns = 0;
+		channel->fw_phase_pull_in_queued = false;
+
+		return -1;
 	}
 
-	idtcm->tod_write_overhead_ns = lowest_ns;
+	channel->fw_phase_pull_in = false;
+	channel->phase_pull_in_done = ktime_get();
 
-	return err;
+	if (!channel->fw_phase_pull_in_queued)
+		return -1;
+
+	offset_ns = channel->fw_phase_pull_in_queued_ns;
+	channel->fw_phase_pull_in_queued_ns = 0;
+	channel->fw_phase_pull_in_queued = false;
+
+	if (abs(offset_ns) < PHASE_PULL_IN_MIN_THRESHOLD_NS)
+		return -1;
+
+	err = _do_phase_pull_in_fw(channel, offset_ns,
+				   channel->fw_phase_pull_in_queued_ffo_ppb);
+	if (err)
+		dev_err(idtcm->dev,
+			"Failed to start queued phase pull-in: %d", err);
+
+	/* A started pull-in has already rescheduled the worker */
+	return -1;
 }
 
 static int _idtcm_adjtime_deprecated(struct idtcm_channel *channel, s64 delta)
@@ -1042,10 +1255,6 @@ static int _idtcm_adjtime_deprecated(struct idtcm_channel *channel, s64 delta)
 	} else {
 		idtcm->calculate_overhead_flag = 1;
 
-		err = set_tod_write_overhead(channel);
-		if (err)
-			return err;
-
 		err = _idtcm_gettime_immediate(channel, &ts);
 		if (err)
 			return err;
@@ -1076,7 +1285,12 @@ static int idtcm_state_machine_reset(struct idtcm *idtcm)
 
 	if (!err) {
 		for (i = 0; i < 30; i++) {
+			/*
+			 * Keep the lock: the chip is rebooting in the middle of a
+			 * firmware load, other RSMU users must not reach it now
+			 */
 			msleep_interruptible(100);
+
 			read_boot_status(idtcm, &status);
 
 			if (status == 0xA0) {
@@ -1531,34 +1745,6 @@ static int configure_manual_reference_write_phase(struct idtcm_channel *channel)
 	return err;
 }
 
-static int idtcm_stop_phase_pull_in(struct idtcm_channel *channel)
-{
-	int err;
-
-	err = _idtcm_adjfine(channel, channel->current_freq_scaled_ppm);
-	if (err)
-		return err;
-
-	channel->phase_pull_in = false;
-
-	return 0;
-}
-
-static long idtcm_work_handler(struct ptp_clock_info *ptp)
-{
-	struct idtcm_channel *channel = container_of(ptp, struct idtcm_channel, caps);
-	struct idtcm *idtcm = channel->idtcm;
-
-	mutex_lock(idtcm->lock);
-
-	(void)idtcm_stop_phase_pull_in(channel);
-
-	mutex_unlock(idtcm->lock);
-
-	/* Return a negative value here to not reschedule */
-	return -1;
-}
-
 static s32 phase_pull_in_scaled_ppm(s32 current_ppm, s32 phase_pull_in_ppb)
 {
 	/* ppb = scaled_ppm * 125 / 2^13 */
@@ -1577,28 +1763,23 @@ static s32 phase_pull_in_scaled_ppm(s32 current_ppm, s32 phase_pull_in_ppb)
 	return current_ppm;
 }
 
-static int do_phase_pull_in_sw(struct idtcm_channel *channel,
-			       s32 delta_ns,
-			       u32 max_ffo_ppb)
+static int _do_phase_pull_in_sw(struct idtcm_channel *channel,
+				s32 delta_ns,
+				u32 max_ffo_ppb,
+				u32 duration_ms)
 {
 	s32 current_ppm = channel->current_freq_scaled_ppm;
-	u32 duration_ms = MSEC_PER_SEC;
 	s32 delta_ppm;
-	s32 ppb;
+	s64 ppb;
 	int err;
 
-	/* If the ToD correction is less than PHASE_PULL_IN_MIN_THRESHOLD_NS,
-	 * skip. The error introduced by the ToD adjustment procedure would
-	 * be bigger than the required ToD correction
-	 */
-	if (abs(delta_ns) < PHASE_PULL_IN_MIN_THRESHOLD_NS)
-		return 0;
+	if (channel->shutdown)
+		return -ENODEV;
 
 	if (max_ffo_ppb == 0 || max_ffo_ppb > PHASE_PULL_IN_MAX_PPB)
 		max_ffo_ppb = PHASE_PULL_IN_MAX_PPB;
 
-	/* For most cases, keep phase pull-in duration 1 second */
-	ppb = delta_ns;
+	ppb = div_s64((s64)delta_ns * MSEC_PER_SEC, duration_ms);
 	while (abs(ppb) > max_ffo_ppb) {
 		duration_ms *= 2;
 		ppb /= 2;
@@ -1611,15 +1792,183 @@ static int do_phase_pull_in_sw(struct idtcm_channel *channel,
 	if (err)
 		return err;
 
-	/* schedule the worker to cancel phase pull-in */
-	ptp_schedule_worker(channel->ptp_clock,
-			    msecs_to_jiffies(duration_ms) - 1);
-
+	/* Time the pull-in from the moment the new FCW has landed */
+	channel->phase_pull_in_start = ktime_get();
+	channel->phase_pull_in_duration_ns = (s64)duration_ms * NSEC_PER_MSEC;
+	channel->phase_pull_in_end = ktime_add_ms(channel->phase_pull_in_start,
+						  duration_ms);
+	channel->phase_pull_in_scaled_ppm = delta_ppm - current_ppm;
 	channel->phase_pull_in = true;
 
+	hrtimer_start(&channel->phase_pull_in_timer, ms_to_ktime(duration_ms),
+		      HRTIMER_MODE_REL);
+
 	return 0;
 }
 
+/* Phase still to be applied by the running software phase pull-in */
+static s32 idtcm_phase_pull_in_remaining_ns(struct idtcm_channel *channel)
+{
+	s64 left_ns;
+
+	left_ns = channel->phase_pull_in_duration_ns -
+		  ktime_to_ns(ktime_sub(ktime_get(),
+					channel->phase_pull_in_start));
+	left_ns = clamp_t(s64, left_ns, 0, channel->phase_pull_in_duration_ns);
+
+	/* ppb = scaled_ppm * 125 / 2^13 */
+	left_ns = ((s64)channel->phase_pull_in_scaled_ppm * 125 * left_ns) >> 13;
+
+	return (s32)div_s64(left_ns, NSEC_PER_SEC);
+}
+
+static int do_phase_pull_in_sw(struct idtcm_channel *channel,
+			       s32 delta_ns,
+			       u32 max_ffo_ppb)
+{
+	int err;
+
+	/* Merge with a pull-in that is still running instead of failing */
+	if (channel->phase_pull_in) {
+		hrtimer_cancel(&channel->phase_pull_in_timer);
+		delta_ns += idtcm_phase_pull_in_remaining_ns(channel);
+		channel->phase_pull_in_correction = false;
+	}
+
+	/* If the ToD correction is less than PHASE_PULL_IN_MIN_THRESHOLD_NS,
+	 * skip. The error introduced by the ToD adjustment procedure would
+	 * be bigger than the required ToD correction
+	 */
+	if (abs(delta_ns) < PHASE_PULL_IN_MIN_THRESHOLD_NS) {
+		if (!channel->phase_pull_in)
+			return 0;
+
+		err = _idtcm_adjfine(channel, channel->current_freq_scaled_ppm);
+		if (err)
+			return err;
+
+		channel->phase_pull_in = false;
+		channel->phase_pull_in_done = ktime_get();
+
+		return 0;
+	}
+
+	/* For most cases, keep phase pull-in duration 1 second */
+	return _do_phase_pull_in_sw(channel, delta_ns, max_ffo_ppb,
+				    MSEC_PER_SEC);
+}
+
+static int idtcm_stop_phase_pull_in(struct idtcm_channel *channel)
+{
+	s64 overrun_ns, residual_ns;
+	int err;
+
+	err = _idtcm_adjfine(channel, channel->current_freq_scaled_ppm);
+	if (err)
+		return err;
+
+	overrun_ns = ktime_to_ns(ktime_sub(ktime_get(),
+					   channel->phase_pull_in_start)) -
+		     channel->phase_pull_in_duration_ns;
+	overrun_ns = clamp_t(s64, overrun_ns, -NSEC_PER_SEC, NSEC_PER_SEC);
+
+	channel->phase_pull_in = false;
+	channel->phase_pull_in_done = ktime_get();
+
+	if (channel->phase_pull_in_correction) {
+		channel->phase_pull_in_correction = false;
+		return 0;
+	}
+
+	/*
+	 * Phase gained while the pull-in ran longer (or shorter) than planned.
+	 * ppb = scaled_ppm * 125 / 2^13
+	 */
+	residual_ns = ((s64)channel->phase_pull_in_scaled_ppm * 125 *
+		       overrun_ns) >> 13;
+	residual_ns = div_s64(residual_ns, NSEC_PER_SEC);
+
+	if (abs(residual_ns) < PHASE_PULL_IN_MIN_THRESHOLD_NS)
+		return 0;
+
+	/*
+	 * Take the residual back out over PHASE_PULL_IN_CORRECTION_MS, that
+	 * is at residual * 10 ppb. The window is stretched as needed to stay
+	 * within PHASE_PULL_IN_MAX_PPB.
+	 */
+	channel->phase_pull_in_correction = true;
+
+	err = _do_phase_pull_in_sw(channel, -residual_ns, 0,
+				   PHASE_PULL_IN_CORRECTION_MS);
+	if (err)
+		channel->phase_pull_in_correction = false;
+
+	return err;
+}
+
+static enum hrtimer_restart idtcm_phase_pull_in_timer_fn(struct hrtimer *timer)
+{
+	struct idtcm_channel *channel = container_of(timer, struct idtcm_channel,
+						     phase_pull_in_timer);
+
+	/* Bus access sleeps, so the aux worker restores the frequency */
+	ptp_schedule_worker(channel->ptp_clock, 0);
+
+	return HRTIMER_NORESTART;
+}
+
+static long idtcm_work_handler(struct ptp_clock_info *ptp)
+{
+	struct idtcm_channel *channel = container_of(ptp, struct idtcm_channel, caps);
+	struct idtcm *idtcm = channel->idtcm;
+	long delay = -1;
+
+	mutex_lock(idtcm->lock);
+
+	/*
+	 * A merged pull-in may have re-armed the timer since we were queued.
+	 * hrtimer_active() is also true while the callback that queued us is
+	 * still returning, only a queued timer means the pull-in goes on.
+	 */
+	if (channel->phase_pull_in &&
+	    !hrtimer_is_queued(&channel->phase_pull_in_timer))
+		(void)idtcm_stop_phase_pull_in(channel);
+
+	if (channel->fw_phase_pull_in)
+		delay = idtcm_check_fw_phase_pull_in(channel);
+
+	mutex_unlock(idtcm->lock);
+
+	/* Return a negative value here to not reschedule */
+	return delay;
+}
+
+/*
+ * "active <expected end>" while a pull-in runs, "idle <last end>" otherwise;
+ * both times are CLOCK_MONOTONIC nanoseconds.
+ */
+static ssize_t phase_pull_in_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct idtcm_channel *channel = container_of(attr, struct idtcm_channel,
+						     phase_pull_in_attr);
+	struct idtcm *idtcm = channel->idtcm;
+	ssize_t len;
+
+	mutex_lock(idtcm->lock);
+
+	if (channel->phase_pull_in || channel->fw_phase_pull_in)
+		len = sysfs_emit(buf, "active %lld\n",
+				 ktime_to_ns(channel->phase_pull_in_end));
+	else
+		len = sysfs_emit(buf, "idle %lld\n",
+				 ktime_to_ns(channel->phase_pull_in_done));
+
+	mutex_unlock(idtcm->lock);
+
+	return len;
+}
+
 static int initialize_operating_mode_with_manual_reference(struct idtcm_channel *channel,
 							   enum manual_reference ref)
 {
@@ -1756,6 +2105,20 @@ static int _idtcm_adjphase(struct idtcm_channel *channel, s32 delta_ns)
 	return err;
 }
 
+/* Frequency to program: the servo's base plus any software pull-in delta */
+static s32 idtcm_composed_scaled_ppm(struct idtcm_channel *channel)
+{
+	s64 max_scaled_ppm = div_s64((s64)PHASE_PULL_IN_MAX_PPB << 13, 125);
+	s64 scaled_ppm = channel->current_freq_scaled_ppm;
+
+	if (!channel->phase_pull_in)
+		return scaled_ppm;
+
+	scaled_ppm += channel->phase_pull_in_scaled_ppm;
+
+	return clamp_t(s64, scaled_ppm, -max_scaled_ppm, max_scaled_ppm);
+}
+
 static int _idtcm_adjfine(struct idtcm_channel *channel, long scaled_ppm)
 {
 	struct idtcm *idtcm = channel->idtcm;
@@ -1878,9 +2241,6 @@ static int idtcm_adjtime(struct ptp_clock_info *ptp, s64 delta)
 	enum scsr_tod_write_type_sel type;
 	int err;
 
-	if (channel->phase_pull_in == true)
-		return -EBUSY;
-
 	mutex_lock(idtcm->lock);
 
 	if (abs(delta) < PHASE_PULL_IN_THRESHOLD_NS) {
@@ -1926,20 +2286,24 @@ static int idtcm_adjfine(struct ptp_clock_info *ptp,  long scaled_ppm)
 {
 	struct idtcm_channel *channel = container_of(ptp, struct idtcm_channel, caps);
 	struct idtcm *idtcm = channel->idtcm;
+	s32 prev_scaled_ppm;
 	int err;
 
-	if (channel->phase_pull_in == true)
-		return 0;
-
 	mutex_lock(idtcm->lock);
-	err = _idtcm_adjfine(channel, scaled_ppm);
+
+	/* Keep tracking the servo during a phase pull-in */
+	prev_scaled_ppm = channel->current_freq_scaled_ppm;
+	channel->current_freq_scaled_ppm = scaled_ppm;
+
+	err = _idtcm_adjfine(channel, idtcm_composed_scaled_ppm(channel));
+	if (err)
+		channel->current_freq_scaled_ppm = prev_scaled_ppm;
+
 	mutex_unlock(idtcm->lock);
 
 	if (err)
 		dev_err(idtcm->dev,
 			"Failed at line %d in %s!", __LINE__, __func__);
-	else
-		channel->current_freq_scaled_ppm = scaled_ppm;
 
 	return err;
 }
@@ -2273,6 +2637,10 @@ static int idtcm_enable_channel(struct idtcm *idtcm, u32 index)
 
 	channel->idtcm = idtcm;
 	channel->current_freq_scaled_ppm = 0;
+	channel->tod_busy = false;
+	channel->tod_write_pending = false;
+	init_completion(&channel->tod_idle);
+	channel->settime_pps = !!(settime_pps_mask & BIT(index));
 
 	/* Set pll addresses */
 	err = configure_channel_pll(channel);
@@ -2320,6 +2688,10 @@ static int idtcm_enable_channel(struct idtcm *idtcm, u32 index)
 
 	channel->dco_delay = idtcm_get_dco_delay(channel);
 
+	hrtimer_init(&channel->phase_pull_in_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	channel->phase_pull_in_timer.function = idtcm_phase_pull_in_timer_fn;
+
 	channel->ptp_clock = ptp_clock_register(&channel->caps, NULL);
 
 	if (IS_ERR(channel->ptp_clock)) {
@@ -2334,6 +2706,18 @@ static int idtcm_enable_channel(struct idtcm *idtcm, u32 index)
 	dev_info(idtcm->dev, "PLL%d registered as ptp%d",
 		 index, channel->ptp_clock->index);
 
+	snprintf(channel->phase_pull_in_attr_name,
+		 sizeof(channel->phase_pull_in_attr_name),
+		 "tod%u_phase_pull_in", index);
+	sysfs_attr_init(&channel->phase_pull_in_attr.attr);
+	channel->phase_pull_in_attr.attr.name = channel->phase_pull_in_attr_name;
+	channel->phase_pull_in_attr.attr.mode = 0444;
+	channel->phase_pull_in_attr.show = phase_pull_in_show;
+
+	if (device_create_file(idtcm->dev, &channel->phase_pull_in_attr))
+		dev_warn(idtcm->dev, "Failed to create %s",
+			 channel->phase_pull_in_attr_name);
+
 	return 0;
 }
 
@@ -2405,8 +2789,22 @@ static void ptp_clock_unregister_all(struct idtcm *idtcm)
 
 	for (i = 0; i < MAX_TOD; i++) {
 		channel = &idtcm->channel[i];
-		if (channel->ptp_clock)
+		if (channel->ptp_clock) {
+			device_remove_file(idtcm->dev,
+					   &channel->phase_pull_in_attr);
+
+			/*
+			 * The aux worker and PHC operations still running can
+			 * arm the timer, stop that before cancelling it so no
+			 * callback is left to schedule the freed clock.
+			 */
+			mutex_lock(idtcm->lock);
+			channel->shutdown = true;
+			mutex_unlock(idtcm->lock);
+
+			hrtimer_cancel(&channel->phase_pull_in_timer);
 			ptp_clock_unregister(channel->ptp_clock);
+		}
 	}
 }
 
@@ -2431,6 +2829,18 @@ static void set_default_masks(struct idtcm *idtcm)
 	idtcm->channel[3].output_mask = DEFAULT_OUTPUT_MASK_PLL3;
 }
 
+static int tod_write_latency_show(struct seq_file *s, void *data)
+{
+	struct idtcm *idtcm = s->private;
+
+	mutex_lock(idtcm->lock);
+	bus_latency_show(s, &idtcm->tod_write_latency);
+	mutex_unlock(idtcm->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tod_write_latency);
+
 static int idtcm_probe(struct platform_device *pdev)
 {
 	struct rsmu_ddata *ddata = dev_get_drvdata(pdev->dev.parent);
@@ -2445,9 +2855,11 @@ static int idtcm_probe(struct platform_device *pdev)
 
 	idtcm->dev = &pdev->dev;
 	idtcm->mfd = pdev->dev.parent;
+	idtcm->ddata = ddata;
 	idtcm->lock = &ddata->lock;
 	idtcm->regmap = ddata->regmap;
 	idtcm->calculate_overhead_flag = 0;
+	bus_latency_init(&idtcm->tod_write_latency);
 
 	INIT_DELAYED_WORK(&idtcm->extts_work, idtcm_extts_check);
 
@@ -2496,6 +2908,10 @@ static int idtcm_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, idtcm);
 
+	idtcm->debugfs = debugfs_create_dir(dev_name(idtcm->dev), NULL);
+	debugfs_create_file("tod_write_latency", 0444, idtcm->debugfs,
+			    idtcm, &tod_write_latency_fops);
+
 	return 0;
 }
 
@@ -2503,6 +2919,8 @@ static int idtcm_remove(struct platform_device *pdev)
 {
 	struct idtcm *idtcm = platform_get_drvdata(pdev);
 
+	debugfs_remove_recursive(idtcm->debugfs);
+
 	idtcm->extts_mask = 0;
 	ptp_clock_unregister_all(idtcm);
 	cancel_delayed_work_sync(&idtcm->extts_work);
@@ -8,11 +8,15 @@
 #ifndef PTP_IDTCLOCKMATRIX_H
 #define PTP_IDTCLOCKMATRIX_H
 
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
 #include <linux/ktime.h>
 #include <linux/mfd/idt8a340_reg.h>
 #include <linux/ptp_clock.h>
 #include <linux/regmap.h>
 
+#include "ptp_bus_latency.h"
+
 #define FW_FILENAME	"idtcm.bin"
 #define MAX_TOD		(4)
 #define MAX_PLL		(8)
@@ -23,14 +27,20 @@
 
 #define PHASE_PULL_IN_THRESHOLD_NS_DEPRECATED	(150000)
 #define PHASE_PULL_IN_THRESHOLD_NS		(15000)
-#define TOD_WRITE_OVERHEAD_COUNT_MAX		(2)
 #define TOD_BYTE_COUNT				(11)
 
 #define LOCK_TIMEOUT_MS			(2000)
 #define LOCK_POLL_INTERVAL_MS		(10)
+#define TOD_IDLE_TIMEOUT_MS		(2000)
+#define SYNC_PLL_OUTPUT_MAX_OPS		(6)
 
 #define PHASE_PULL_IN_MAX_PPB		(144000)
 #define PHASE_PULL_IN_MIN_THRESHOLD_NS	(2)
+#define PHASE_PULL_IN_CORRECTION_MS	(100)
+#define PHASE_PULL_IN_POLL_MIN_MS	(10)
+#define PHASE_PULL_IN_POLL_MAX_MS	(100)
+#define PHASE_PULL_IN_TIMEOUT_MS	(5000)
+#define PHASE_PULL_IN_MAX_ERRORS	(3)
 
 /* PTP PLL Mode */
 enum ptp_pll_mode {
@@ -65,7 +75,33 @@ struct idtcm_channel {
 						    s32 offset_ns, u32 max_ffo_ppb);
 	s32			current_freq_scaled_ppm;
 	bool			phase_pull_in;
+	/* ends software phase pull-in; armed once the FCW write has completed */
+	struct hrtimer		phase_pull_in_timer;
+	ktime_t			phase_pull_in_start;
+	s64			phase_pull_in_duration_ns;
+	s32			phase_pull_in_scaled_ppm;
+	bool			phase_pull_in_correction;
+	/* set on unregister, the timer must not be armed again */
+	bool			shutdown;
+	/* firmware phase pull-in being polled, and the request queued behind it */
+	bool			fw_phase_pull_in;
+	unsigned long		fw_phase_pull_in_poll;
+	u8			fw_phase_pull_in_errors;
+	bool			fw_phase_pull_in_queued;
+	s64			fw_phase_pull_in_queued_ns;
+	u32			fw_phase_pull_in_queued_ffo_ppb;
+	/* expected end of the running pull-in, and when the last one ended */
+	ktime_t			phase_pull_in_end;
+	ktime_t			phase_pull_in_done;
+	struct device_attribute	phase_pull_in_attr;
+	char			phase_pull_in_attr_name[24];
 	u32			dco_delay;
+	/* set while a TOD write sleeps with the device lock dropped */
+	bool			tod_busy;
+	struct completion	tod_idle;
+	/* TOD writes trigger on TOD PPS; one is armed and not yet landed */
+	bool			settime_pps;
+	bool			tod_write_pending;
 	/* last input trigger for extts */
 	u8			refn;
 	u8			pll;
@@ -88,11 +124,13 @@ struct idtcm {
 	/* Mutex to protect operations from being interrupted */
 	struct mutex		*lock;
 	struct device		*mfd;
+	struct rsmu_ddata	*ddata;
 	struct regmap		*regmap;
 	/* Overhead calculation for adjtime */
 	u8			calculate_overhead_flag;
-	s64			tod_write_overhead_ns;
+	struct bus_latency	tod_write_latency;
 	ktime_t			start_time;
+	struct dentry		*debugfs;
 };
 
 #endif /* PTP_IDTCLOCKMATRIX_H */
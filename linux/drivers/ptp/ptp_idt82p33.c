@@ -5,6 +5,7 @@
 
 #define pr_fmt(fmt) "IDT_82p33xxx: " fmt
 
+#include <linux/debugfs.h>
 #include <linux/firmware.h>
 #include <linux/platform_device.h>
 #include <linux/module.h>
@@ -223,6 +224,7 @@ static int arm_tod_read_with_trigger(struct idt82p33_channel *channel, u8 trigge
 		return err;
 
 	memcpy(channel->extts_tod_sts, buf, TOD_BYTE_COUNT);
+	channel->discard_next_extts = false;
 
 	err = idt82p33_set_tod_trigger(channel, trigger, false);
 
@@ -327,82 +329,72 @@ static int idt82p33_extts_check_channel(struct idt82p33 *idt82p33, u8 todn)
 	return err;
 }
 
-static u8 idt82p33_extts_enable_mask(struct idt82p33_channel *channel,
-				     u8 extts_mask, bool enable)
-{
-	struct idt82p33 *idt82p33 = channel->idt82p33;
-	u8 trigger = channel->tod_trigger;
-	u8 mask;
-	int err;
-	int i;
-
-	if (extts_mask == 0)
-		return 0;
-
-	if (enable == false)
-		cancel_delayed_work_sync(&idt82p33->extts_work);
-
-	for (i = 0; i < MAX_PHC_PLL; i++) {
-		mask = 1 << i;
-
-		if ((extts_mask & mask) == 0)
-			continue;
-
-		if (enable) {
-			err = arm_tod_read_with_trigger(&idt82p33->channel[i], trigger);
-			if (err)
-				dev_err(idt82p33->dev,
-					"%s: Arm ToD read trigger failed, err = %d",
-					__func__, err);
-		} else {
-			err = idt82p33_extts_check_channel(idt82p33, i);
-			if (err == 0 && idt82p33->extts_single_shot)
-				/* trigger happened so we won't re-enable it */
-				extts_mask &= ~mask;
-		}
-	}
-
-	if (enable)
-		schedule_delayed_work(&idt82p33->extts_work,
-				      msecs_to_jiffies(EXTTS_PERIOD_MS));
-
-	return extts_mask;
-}
-
 static int _idt82p33_gettime(struct idt82p33_channel *channel,
 			     struct timespec64 *ts)
 {
 	struct idt82p33 *idt82p33 = channel->idt82p33;
-	u8 old_mask = idt82p33->extts_mask;
+	u8 mask = 1 << channel->plln;
 	u8 buf[TOD_BYTE_COUNT];
-	u8 new_mask = 0;
+	u8 cfg, trigger;
+	ktime_t latched;
 	int err;
 
-	/* Disable extts */
-	if (old_mask)
-		new_mask = idt82p33_extts_enable_mask(channel, old_mask, false);
+	/*
+	 * TOD_STS is shared by software reads and extts capture. Harvest an
+	 * event already latched on this TOD before the read trigger is
+	 * switched, so that it is not overwritten by the software read.
+	 */
+	if (idt82p33->extts_mask & mask) {
+		err = idt82p33_extts_check_channel(idt82p33, channel->plln);
+		if (err == 0 && idt82p33->extts_single_shot)
+			/* trigger happened so we won't re-arm it */
+			idt82p33->extts_mask &= ~mask;
+		else if (err && err != -EAGAIN)
+			return err;
+	}
 
-	err = idt82p33_set_tod_trigger(channel, HW_TOD_RD_TRIG_SEL_LSB_TOD_STS,
-				       false);
+	/* Snapshot the trigger register so it can be restored afterwards */
+	err = idt82p33_read(idt82p33, channel->dpll_tod_trigger,
+			    &cfg, sizeof(cfg));
 	if (err)
 		return err;
 
-	channel->discard_next_extts = true;
+	trigger = (HW_TOD_RD_TRIG_SEL_LSB_TOD_STS << READ_TRIGGER_SHIFT) |
+		  (cfg & WRITE_TRIGGER_MASK);
+
+	if (trigger != cfg) {
+		err = idt82p33_write(idt82p33, channel->dpll_tod_trigger,
+				     &trigger, sizeof(trigger));
+		if (err)
+			return err;
+	}
 
 	if (idt82p33->calculate_overhead_flag)
 		idt82p33->start_time = ktime_get_raw();
 
+	/* Reading the LSB latches TOD_STS */
+	latched = ktime_get();
+
 	err = idt82p33_read(idt82p33, channel->dpll_tod_sts, buf, sizeof(buf));
 
 	if (err)
 		return err;
 
-	/* Re-enable extts */
-	if (new_mask)
-		idt82p33_extts_enable_mask(channel, new_mask, true);
+	if ((idt82p33->extts_mask & mask) && trigger != cfg) {
+		/* TOD_STS now holds our read, so track it as the last value */
+		memcpy(channel->extts_tod_sts, buf, TOD_BYTE_COUNT);
+
+		err = idt82p33_write(idt82p33, channel->dpll_tod_trigger,
+				     &cfg, sizeof(cfg));
+		if (err)
+			return err;
+	}
 
 	idt82p33_byte_array_to_timespec(ts, buf);
 
+	channel->last_tod = *ts;
+	channel->last_tod_ktime = latched;
+
 	return 0;
 }
 
@@ -412,15 +404,58 @@ static int _idt82p33_gettime(struct idt82p33_channel *channel,
  *   Bits[3:0] Read 0x9, LSB read
  */
 
+/*
+ * Sleep with idt82p33->lock dropped so the other PLL and the cdev are not
+ * held off.  The channel stays marked busy until the lock is held again.
+ */
+static void idt82p33_tod_sleep(struct idt82p33_channel *channel,
+			       unsigned long us)
+{
+	struct idt82p33 *idt82p33 = channel->idt82p33;
+
+	channel->tod_busy = true;
+	reinit_completion(&channel->tod_idle);
+	mutex_unlock(idt82p33->lock);
+
+	usleep_range(us, us + USEC_PER_MSEC);
+
+	mutex_lock(idt82p33->lock);
+	channel->tod_busy = false;
+	complete_all(&channel->tod_idle);
+}
+
+/* Called with idt82p33->lock held; waits out a TOD write sleeping on it */
+static int idt82p33_wait_tod_idle(struct idt82p33_channel *channel)
+{
+	struct idt82p33 *idt82p33 = channel->idt82p33;
+	unsigned long left;
+
+	while (channel->tod_busy) {
+		mutex_unlock(idt82p33->lock);
+		left = wait_for_completion_timeout(&channel->tod_idle,
+						   msecs_to_jiffies(TOD_IDLE_TIMEOUT_MS));
+		mutex_lock(idt82p33->lock);
+
+		if (!left)
+			return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
 static int _idt82p33_settime(struct idt82p33_channel *channel,
 			     struct timespec64 const *ts)
 {
 	struct idt82p33 *idt82p33 = channel->idt82p33;
 	struct timespec64 local_ts = *ts;
-	char buf[TOD_BYTE_COUNT];
+	u8 buf[TOD_BYTE_COUNT];
 	s64 dynamic_overhead_ns;
+	ktime_t start;
 	int err;
-	u8 i;
+
+	err = idt82p33_wait_tod_idle(channel);
+	if (err)
+		return err;
 
 	err = idt82p33_set_tod_trigger(channel, HW_TOD_WR_TRIG_SEL_MSB_TOD_CNFG,
 				       true);
@@ -441,14 +476,17 @@ static int _idt82p33_settime(struct idt82p33_channel *channel,
 	idt82p33_timespec_to_byte_array(&local_ts, buf);
 
 	/*
-	 * Store the new time value.
+	 * Store the new time value in one burst. The MSB is the last byte
+	 * on the bus, so the TOD is loaded when the transaction completes.
+	 * The burst also feeds the bus latency estimate used by adjtime.
 	 */
-	for (i = 0; i < TOD_BYTE_COUNT; i++) {
-		err = idt82p33_write(idt82p33, channel->dpll_tod_cnfg + i,
-				     &buf[i], sizeof(buf[i]));
-		if (err)
-			return err;
-	}
+	start = ktime_get_raw();
+
+	err = idt82p33_write(idt82p33, channel->dpll_tod_cnfg,
+			     buf, sizeof(buf));
+	if (!err)
+		bus_latency_add(&idt82p33->tod_write_latency, start,
+				ktime_get_raw());
 
 	return err;
 }
@@ -469,7 +507,7 @@ static int _idt82p33_adjtime_immediate(struct idt82p33_channel *channel,
 		return err;
 
 	now_ns = timespec64_to_ns(&ts);
-	now_ns += delta_ns + idt82p33->tod_write_overhead_ns;
+	now_ns += delta_ns + idt82p33->tod_write_latency.estimate_ns;
 
 	ts = ns_to_timespec64(now_ns);
 
@@ -478,6 +516,13 @@ static int _idt82p33_adjtime_immediate(struct idt82p33_channel *channel,
 	return err;
 }
 
+/* CLOCK_MONOTONIC time of the next PHC second, predicted from the last read */
+static ktime_t idt82p33_next_tod_second(struct idt82p33_channel *channel)
+{
+	return ktime_add_ns(channel->last_tod_ktime,
+			    NSEC_PER_SEC - channel->last_tod.tv_nsec);
+}
+
 static int _idt82p33_adjtime_internal_triggered(struct idt82p33_channel *channel,
 						s64 delta_ns)
 {
@@ -485,21 +530,34 @@ static int _idt82p33_adjtime_internal_triggered(struct idt82p33_channel *channel
 	char buf[TOD_BYTE_COUNT];
 	struct timespec64 ts;
 	const u8 delay_ns = 32;
+	s64 to_edge_ns;
 	s32 remainder;
+	ktime_t edge;
 	s64 ns;
 	int err;
 
+	err = idt82p33_wait_tod_idle(channel);
+	if (err)
+		return err;
+
 	err = _idt82p33_gettime(channel, &ts);
 
 	if (err)
 		return err;
 
-	if (ts.tv_nsec > (NSEC_PER_SEC - 5 * NSEC_PER_MSEC)) {
-		/*  Too close to miss next trigger, so skip it */
-		mdelay(6);
-		ns = (ts.tv_sec + 2) * NSEC_PER_SEC + delta_ns + delay_ns;
-	} else
-		ns = (ts.tv_sec + 1) * NSEC_PER_SEC + delta_ns + delay_ns;
+	edge = idt82p33_next_tod_second(channel);
+	to_edge_ns = ktime_to_ns(ktime_sub(edge, ktime_get()));
+
+	if (to_edge_ns < TOD_PPS_GUARD_MS * NSEC_PER_MSEC) {
+		/*  Too close to make the next trigger, sleep past it */
+		idt82p33_tod_sleep(channel,
+				   max_t(s64, to_edge_ns, 0) / NSEC_PER_USEC +
+				   USEC_PER_MSEC);
+		edge = ktime_add_ns(edge, NSEC_PER_SEC);
+		ts.tv_sec++;
+	}
+
+	ns = (ts.tv_sec + 1) * NSEC_PER_SEC + delta_ns + delay_ns;
 
 	ts = ns_to_timespec64(ns);
 	idt82p33_timespec_to_byte_array(&ts, buf);
@@ -511,25 +569,38 @@ static int _idt82p33_adjtime_internal_triggered(struct idt82p33_channel *channel
 	if (err)
 		return err;
 
-	/* Schedule to implement the workaround in one second */
+	err = idt82p33_set_tod_trigger(channel, HW_TOD_TRIG_SEL_TOD_PPS, true);
+	if (err)
+		return err;
+
+	/*
+	 * A step that is not whole seconds needs the workaround once it has
+	 * landed on edge. Fire it mid-way through the stepped PHC second so
+	 * its own trigger is armed well clear of the next PPS.
+	 */
 	(void)div_s64_rem(delta_ns, NSEC_PER_SEC, &remainder);
-	if (remainder != 0)
-		schedule_delayed_work(&channel->adjtime_work, HZ);
+	if (remainder != 0 && !channel->shutdown) {
+		to_edge_ns = NSEC_PER_SEC - ts.tv_nsec + NSEC_PER_SEC / 2;
+		if (to_edge_ns > NSEC_PER_SEC)
+			to_edge_ns -= NSEC_PER_SEC;
+
+		channel->adjtime_workaround = true;
+		hrtimer_start(&channel->adjtime_timer,
+			      ktime_add_ns(edge, to_edge_ns), HRTIMER_MODE_ABS);
+	}
 
-	return idt82p33_set_tod_trigger(channel, HW_TOD_TRIG_SEL_TOD_PPS, true);
+	return 0;
 }
 
-static void idt82p33_adjtime_workaround(struct work_struct *work)
+static enum hrtimer_restart idt82p33_adjtime_timer_fn(struct hrtimer *timer)
 {
-	struct idt82p33_channel *channel = container_of(work,
-							struct idt82p33_channel,
-							adjtime_work.work);
-	struct idt82p33 *idt82p33 = channel->idt82p33;
+	struct idt82p33_channel *channel =
+			container_of(timer, struct idt82p33_channel, adjtime_timer);
 
-	mutex_lock(idt82p33->lock);
-	/* Workaround for TOD-to-output alignment issue */
-	_idt82p33_adjtime_internal_triggered(channel, 0);
-	mutex_unlock(idt82p33->lock);
+	/* Bus access sleeps, so the aux worker applies the workaround */
+	ptp_schedule_worker(channel->ptp_clock, 0);
+
+	return HRTIMER_NORESTART;
 }
 
 static int _idt82p33_adjfine(struct idt82p33_channel *channel, long scaled_ppm)
@@ -588,217 +659,155 @@ static s32 idt82p33_ddco_scaled_ppm(long current_ppm, s32 ddco_ppb)
 	return (s32)current_ppm;
 }
 
-static int idt82p33_stop_ddco(struct idt82p33_channel *channel)
-{
-	int err;
-
-	err = _idt82p33_adjfine(channel, channel->current_freq);
-	if (err)
-		return err;
-
-	channel->ddco = false;
-
-	return 0;
-}
-
-static int idt82p33_start_ddco(struct idt82p33_channel *channel, s32 delta_ns)
+static int _idt82p33_start_ddco(struct idt82p33_channel *channel,
+				s32 delta_ns, u32 duration_ms)
 {
 	s32 current_ppm = channel->current_freq;
-	u32 duration_ms = MSEC_PER_SEC;
-	s32 ppb;
+	s32 ddco_ppm;
+	s64 ppb;
 	int err;
 
-	/* If the ToD correction is less than 5 nanoseconds, then skip it.
-	 * The error introduced by the ToD adjustment procedure would be bigger
-	 * than the required ToD correction
-	 */
-	if (abs(delta_ns) < DDCO_THRESHOLD_NS)
-		return 0;
+	if (channel->shutdown)
+		return -ENODEV;
 
-	/* For most cases, keep ddco duration 1 second */
-	ppb = delta_ns;
+	ppb = div_s64((s64)delta_ns * MSEC_PER_SEC, duration_ms);
 	while (abs(ppb) > DCO_MAX_PPB) {
 		duration_ms *= 2;
 		ppb /= 2;
 	}
 
-	err = _idt82p33_adjfine(channel,
-				idt82p33_ddco_scaled_ppm(current_ppm, ppb));
+	ddco_ppm = idt82p33_ddco_scaled_ppm(current_ppm, ppb);
+
+	err = _idt82p33_adjfine(channel, ddco_ppm);
 	if (err)
 		return err;
 
-	/* schedule the worker to cancel ddco */
-	ptp_schedule_worker(channel->ptp_clock,
-			    msecs_to_jiffies(duration_ms) - 1);
+	/* Time the ddco from the moment the new FCW has landed */
+	channel->ddco_start = ktime_get();
+	channel->ddco_duration_ns = (s64)duration_ms * NSEC_PER_MSEC;
+	channel->ddco_scaled_ppm = ddco_ppm - current_ppm;
 	channel->ddco = true;
 
+	hrtimer_start(&channel->ddco_timer, ms_to_ktime(duration_ms),
+		      HRTIMER_MODE_REL);
+
 	return 0;
 }
 
-static int idt82p33_measure_one_byte_write_overhead(
-		struct idt82p33_channel *channel, s64 *overhead_ns)
+/* Frequency to program: the servo's base plus any double dco delta */
+static s32 idt82p33_ddco_composed_ppm(struct idt82p33_channel *channel)
 {
-	struct idt82p33 *idt82p33 = channel->idt82p33;
-	ktime_t start, stop;
-	u8 trigger = 0;
-	s64 total_ns;
-	int err;
-	u8 i;
-
-	total_ns = 0;
-	*overhead_ns = 0;
-
-	for (i = 0; i < MAX_MEASURMENT_COUNT; i++) {
-
-		start = ktime_get_raw();
-
-		err = idt82p33_write(idt82p33, channel->dpll_tod_trigger,
-				     &trigger, sizeof(trigger));
-
-		stop = ktime_get_raw();
-
-		if (err)
-			return err;
+	s64 max_scaled_ppm = div_s64(((s64)DCO_MAX_PPB << 13), 125);
+	s64 scaled_ppm = channel->current_freq;
 
-		total_ns += ktime_to_ns(stop) - ktime_to_ns(start);
-	}
+	if (!channel->ddco)
+		return scaled_ppm;
 
-	*overhead_ns = div_s64(total_ns, MAX_MEASURMENT_COUNT);
+	scaled_ppm += channel->ddco_scaled_ppm;
 
-	return err;
+	return clamp_t(s64, scaled_ppm, -max_scaled_ppm, max_scaled_ppm);
 }
 
-static int idt82p33_measure_one_byte_read_overhead(
-		struct idt82p33_channel *channel, s64 *overhead_ns)
+static int idt82p33_stop_ddco(struct idt82p33_channel *channel)
 {
-	struct idt82p33 *idt82p33 = channel->idt82p33;
-	ktime_t start, stop;
-	u8 trigger = 0;
-	s64 total_ns;
+	s64 overrun_ns, residual_ns;
 	int err;
-	u8 i;
 
-	total_ns = 0;
-	*overhead_ns = 0;
-
-	for (i = 0; i < MAX_MEASURMENT_COUNT; i++) {
-
-		start = ktime_get_raw();
-
-		err = idt82p33_read(idt82p33, channel->dpll_tod_trigger,
-				    &trigger, sizeof(trigger));
+	err = _idt82p33_adjfine(channel, channel->current_freq);
+	if (err)
+		return err;
 
-		stop = ktime_get_raw();
+	overrun_ns = ktime_to_ns(ktime_sub(ktime_get(), channel->ddco_start)) -
+		     channel->ddco_duration_ns;
+	overrun_ns = clamp_t(s64, overrun_ns, -NSEC_PER_SEC, NSEC_PER_SEC);
 
-		if (err)
-			return err;
+	channel->ddco = false;
 
-		total_ns += ktime_to_ns(stop) - ktime_to_ns(start);
+	if (channel->ddco_correction) {
+		channel->ddco_correction = false;
+		return 0;
 	}
 
-	*overhead_ns = div_s64(total_ns, MAX_MEASURMENT_COUNT);
-
-	return err;
-}
-
-static int idt82p33_measure_tod_write_9_byte_overhead(
-		struct idt82p33_channel *channel)
-{
-	struct idt82p33 *idt82p33 = channel->idt82p33;
-	u8 buf[TOD_BYTE_COUNT];
-	ktime_t start, stop;
-	s64 total_ns;
-	int err = 0;
-	u8 i, j;
-
-	total_ns = 0;
-	idt82p33->tod_write_overhead_ns = 0;
-
-	for (i = 0; i < MAX_MEASURMENT_COUNT; i++) {
-
-		start = ktime_get_raw();
-
-		/* Need one less byte for applicable overhead */
-		for (j = 0; j < (TOD_BYTE_COUNT - 1); j++) {
-			err = idt82p33_write(idt82p33,
-					     channel->dpll_tod_cnfg + i,
-					     &buf[i], sizeof(buf[i]));
-			if (err)
-				return err;
-		}
+	/*
+	 * Phase gained while the ddco ran longer (or shorter) than planned.
+	 * ppb = scaled_ppm * 125 / 2^13
+	 */
+	residual_ns = ((s64)channel->ddco_scaled_ppm * 125 * overrun_ns) >> 13;
+	residual_ns = div_s64(residual_ns, NSEC_PER_SEC);
 
-		stop = ktime_get_raw();
+	if (abs(residual_ns) < DDCO_THRESHOLD_NS)
+		return 0;
 
-		total_ns += ktime_to_ns(stop) - ktime_to_ns(start);
-	}
+	/*
+	 * Take the residual back out over DDCO_CORRECTION_MS, that is at
+	 * residual * 10 ppb. The window is stretched as needed to stay
+	 * within DCO_MAX_PPB.
+	 */
+	channel->ddco_correction = true;
 
-	idt82p33->tod_write_overhead_ns = div_s64(total_ns,
-						  MAX_MEASURMENT_COUNT);
+	err = _idt82p33_start_ddco(channel, -residual_ns, DDCO_CORRECTION_MS);
+	if (err)
+		channel->ddco_correction = false;
 
 	return err;
 }
 
-static int idt82p33_measure_settime_gettime_gap_overhead(
-		struct idt82p33_channel *channel, s64 *overhead_ns)
+/* Phase still to be applied by the running double dco */
+static s32 idt82p33_ddco_remaining_ns(struct idt82p33_channel *channel)
 {
-	struct timespec64 ts1 = {0, 0};
-	struct timespec64 ts2;
-	int err;
-
-	*overhead_ns = 0;
-
-	err = _idt82p33_settime(channel, &ts1);
-
-	if (err)
-		return err;
+	s64 left_ns;
 
-	err = _idt82p33_gettime(channel, &ts2);
+	left_ns = channel->ddco_duration_ns -
+		  ktime_to_ns(ktime_sub(ktime_get(), channel->ddco_start));
+	left_ns = clamp_t(s64, left_ns, 0, channel->ddco_duration_ns);
 
-	if (!err)
-		*overhead_ns = timespec64_to_ns(&ts2) - timespec64_to_ns(&ts1);
+	/* ppb = scaled_ppm * 125 / 2^13 */
+	left_ns = ((s64)channel->ddco_scaled_ppm * 125 * left_ns) >> 13;
 
-	return err;
+	return (s32)div_s64(left_ns, NSEC_PER_SEC);
 }
 
-static int idt82p33_measure_tod_write_overhead(struct idt82p33_channel *channel)
+static int idt82p33_start_ddco(struct idt82p33_channel *channel, s32 delta_ns)
 {
-	s64 trailing_overhead_ns, one_byte_write_ns, gap_ns, one_byte_read_ns;
-	struct idt82p33 *idt82p33 = channel->idt82p33;
 	int err;
 
-	idt82p33->tod_write_overhead_ns = 0;
-
-	err = idt82p33_measure_settime_gettime_gap_overhead(channel, &gap_ns);
-
-	if (err) {
-		dev_err(idt82p33->dev,
-			"Failed in %s with err %d!\n", __func__, err);
-		return err;
+	/* Merge with a ddco that is still running instead of failing */
+	if (channel->ddco) {
+		hrtimer_cancel(&channel->ddco_timer);
+		delta_ns += idt82p33_ddco_remaining_ns(channel);
+		channel->ddco_correction = false;
 	}
 
-	err = idt82p33_measure_one_byte_write_overhead(channel,
-						       &one_byte_write_ns);
-
-	if (err)
-		return err;
+	/* If the ToD correction is less than 5 nanoseconds, then skip it.
+	 * The error introduced by the ToD adjustment procedure would be bigger
+	 * than the required ToD correction
+	 */
+	if (abs(delta_ns) < DDCO_THRESHOLD_NS) {
+		if (!channel->ddco)
+			return 0;
 
-	err = idt82p33_measure_one_byte_read_overhead(channel,
-						      &one_byte_read_ns);
+		err = _idt82p33_adjfine(channel, channel->current_freq);
+		if (err)
+			return err;
 
-	if (err)
-		return err;
+		channel->ddco = false;
 
-	err = idt82p33_measure_tod_write_9_byte_overhead(channel);
+		return 0;
+	}
 
-	if (err)
-		return err;
+	/* For most cases, keep ddco duration 1 second */
+	return _idt82p33_start_ddco(channel, delta_ns, MSEC_PER_SEC);
+}
 
-	trailing_overhead_ns = gap_ns - 2 * one_byte_write_ns
-			       - one_byte_read_ns;
+static enum hrtimer_restart idt82p33_ddco_timer_fn(struct hrtimer *timer)
+{
+	struct idt82p33_channel *channel =
+			container_of(timer, struct idt82p33_channel, ddco_timer);
 
-	idt82p33->tod_write_overhead_ns -= trailing_overhead_ns;
+	/* Bus access sleeps, so the aux worker restores the frequency */
+	ptp_schedule_worker(channel->ptp_clock, 0);
 
-	return err;
+	return HRTIMER_NORESTART;
 }
 
 static int idt82p33_check_and_set_masks(struct idt82p33 *idt82p33,
@@ -870,7 +879,20 @@ static long idt82p33_work_handler(struct ptp_clock_info *ptp)
 	struct idt82p33 *idt82p33 = channel->idt82p33;
 
 	mutex_lock(idt82p33->lock);
-	(void)idt82p33_stop_ddco(channel);
+	/*
+	 * A merged ddco may have re-armed the timer since we were queued.
+	 * hrtimer_active() is also true while the callback that queued us is
+	 * still returning, only a queued timer means the ddco goes on.
+	 */
+	if (channel->ddco && !hrtimer_is_queued(&channel->ddco_timer))
+		(void)idt82p33_stop_ddco(channel);
+
+	/* Workaround for TOD-to-output alignment issue, once its timer fired */
+	if (channel->adjtime_workaround &&
+	    !hrtimer_is_queued(&channel->adjtime_timer)) {
+		channel->adjtime_workaround = false;
+		(void)_idt82p33_adjtime_internal_triggered(channel, 0);
+	}
 	mutex_unlock(idt82p33->lock);
 
 	/* Return a negative value here to not reschedule */
@@ -905,18 +927,9 @@ static int idt82p33_perout_enable(struct idt82p33_channel *channel,
 
 static int idt82p33_enable_tod(struct idt82p33_channel *channel)
 {
-	struct idt82p33 *idt82p33 = channel->idt82p33;
 	struct timespec64 ts = {0, 0};
 	int err;
 
-	err = idt82p33_measure_tod_write_overhead(channel);
-
-	if (err) {
-		dev_err(idt82p33->dev,
-			"Failed in %s with err %d!\n", __func__, err);
-		return err;
-	}
-
 	err = _idt82p33_settime(channel, &ts);
 
 	if (err)
@@ -932,9 +945,20 @@ static void idt82p33_ptp_clock_unregister_all(struct idt82p33 *idt82p33)
 
 	for (i = 0; i < MAX_PHC_PLL; i++) {
 		channel = &idt82p33->channel[i];
-		cancel_delayed_work_sync(&channel->adjtime_work);
-		if (channel->ptp_clock)
+		if (channel->ptp_clock) {
+			/*
+			 * The aux worker and PHC operations still running can
+			 * arm the timers, stop that before cancelling them so
+			 * no callback is left to schedule the freed clock.
+			 */
+			mutex_lock(idt82p33->lock);
+			channel->shutdown = true;
+			mutex_unlock(idt82p33->lock);
+
+			hrtimer_cancel(&channel->adjtime_timer);
+			hrtimer_cancel(&channel->ddco_timer);
 			ptp_clock_unregister(channel->ptp_clock);
+		}
 	}
 }
 
@@ -1025,19 +1049,22 @@ static int idt82p33_adjfine(struct ptp_clock_info *ptp, long scaled_ppm)
 	struct idt82p33_channel *channel =
 			container_of(ptp, struct idt82p33_channel, caps);
 	struct idt82p33 *idt82p33 = channel->idt82p33;
+	s32 prev_freq;
 	int err;
 
-	if (channel->ddco == true)
-		return 0;
-
 	if (scaled_ppm == channel->current_freq)
 		return 0;
 
 	mutex_lock(idt82p33->lock);
-	err = _idt82p33_adjfine(channel, scaled_ppm);
 
-	if (err == 0)
-		channel->current_freq = scaled_ppm;
+	/* Keep tracking the servo during a double dco */
+	prev_freq = channel->current_freq;
+	channel->current_freq = scaled_ppm;
+
+	err = _idt82p33_adjfine(channel, idt82p33_ddco_composed_ppm(channel));
+	if (err)
+		channel->current_freq = prev_freq;
+
 	mutex_unlock(idt82p33->lock);
 
 	if (err)
@@ -1053,9 +1080,6 @@ static int idt82p33_adjtime(struct ptp_clock_info *ptp, s64 delta_ns)
 	struct idt82p33 *idt82p33 = channel->idt82p33;
 	int err;
 
-	if (channel->ddco == true)
-		return -EBUSY;
-
 	mutex_lock(idt82p33->lock);
 
 	if (abs(delta_ns) < phase_snap_threshold) {
@@ -1144,7 +1168,12 @@ static int idt82p33_channel_init(struct idt82p33 *idt82p33, u32 index)
 	channel->plln = index;
 	channel->current_freq = 0;
 	channel->idt82p33 = idt82p33;
-	INIT_DELAYED_WORK(&channel->adjtime_work, idt82p33_adjtime_workaround);
+	channel->tod_busy = false;
+	init_completion(&channel->tod_idle);
+	hrtimer_init(&channel->ddco_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	channel->ddco_timer.function = idt82p33_ddco_timer_fn;
+	hrtimer_init(&channel->adjtime_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	channel->adjtime_timer.function = idt82p33_adjtime_timer_fn;
 
 	return 0;
 }
@@ -1379,6 +1408,18 @@ static void idt82p33_extts_check(struct work_struct *work)
 	mutex_unlock(idt82p33->lock);
 }
 
+static int tod_write_latency_show(struct seq_file *s, void *data)
+{
+	struct idt82p33 *idt82p33 = s->private;
+
+	mutex_lock(idt82p33->lock);
+	bus_latency_show(s, &idt82p33->tod_write_latency);
+	mutex_unlock(idt82p33->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tod_write_latency);
+
 static int idt82p33_probe(struct platform_device *pdev)
 {
 	struct rsmu_ddata *ddata = dev_get_drvdata(pdev->dev.parent);
@@ -1395,8 +1436,8 @@ static int idt82p33_probe(struct platform_device *pdev)
 	idt82p33->mfd = pdev->dev.parent;
 	idt82p33->lock = &ddata->lock;
 	idt82p33->regmap = ddata->regmap;
-	idt82p33->tod_write_overhead_ns = 0;
 	idt82p33->calculate_overhead_flag = 0;
+	bus_latency_init(&idt82p33->tod_write_latency);
 	idt82p33->pll_mask = DEFAULT_PLL_MASK;
 	idt82p33->channel[0].output_mask = DEFAULT_OUTPUT_MASK_PLL0;
 	idt82p33->channel[1].output_mask = DEFAULT_OUTPUT_MASK_PLL1;
@@ -1444,6 +1485,10 @@ static int idt82p33_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, idt82p33);
 
+	idt82p33->debugfs = debugfs_create_dir(dev_name(idt82p33->dev), NULL);
+	debugfs_create_file("tod_write_latency", 0444, idt82p33->debugfs,
+			    idt82p33, &tod_write_latency_fops);
+
 	return 0;
 }
 
@@ -1451,6 +1496,8 @@ static int idt82p33_remove(struct platform_device *pdev)
 {
 	struct idt82p33 *idt82p33 = platform_get_drvdata(pdev);
 
+	debugfs_remove_recursive(idt82p33->debugfs);
+
 	cancel_delayed_work_sync(&idt82p33->extts_work);
 
 	idt82p33_ptp_clock_unregister_all(idt82p33);
@@ -7,20 +7,26 @@
 #ifndef PTP_IDT82P33_H
 #define PTP_IDT82P33_H
 
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
 #include <linux/ktime.h>
 #include <linux/mfd/idt82p33_reg.h>
 #include <linux/regmap.h>
 
+#include "ptp_bus_latency.h"
+
 #define FW_FILENAME	"idt82p33xxx.bin"
 #define MAX_PHC_PLL	(2)
 #define MAX_TRIG_CLK	(3)
 #define MAX_PER_OUT	(11)
 #define TOD_BYTE_COUNT	(10)
 #define DCO_MAX_PPB     (92000)
-#define MAX_MEASURMENT_COUNT	(5)
 #define SNAP_THRESHOLD_NS	(10000)
 #define IMMEDIATE_SNAP_THRESHOLD_NS (50000)
 #define DDCO_THRESHOLD_NS	(5)
+#define DDCO_CORRECTION_MS	(100)
+#define TOD_IDLE_TIMEOUT_MS	(2000)
+#define TOD_PPS_GUARD_MS	(5)
 #define IDT82P33_MAX_WRITE_COUNT	(512)
 
 /**
@@ -42,11 +48,26 @@ struct idt82p33_channel {
 	struct ptp_clock	*ptp_clock;
 	struct idt82p33		*idt82p33;
 	enum pll_mode		pll_mode;
-	/* Workaround for TOD-to-output alignment issue */
-	struct delayed_work	adjtime_work;
+	/* Workaround for TOD-to-output alignment issue, fired mid-second */
+	struct hrtimer		adjtime_timer;
+	bool			adjtime_workaround;
+	/* last TOD read and the CLOCK_MONOTONIC time it was latched */
+	struct timespec64	last_tod;
+	ktime_t			last_tod_ktime;
 	s32			current_freq;
 	/* double dco mode */
 	bool			ddco;
+	/* ends double dco; armed once the FCW write has completed */
+	struct hrtimer		ddco_timer;
+	ktime_t			ddco_start;
+	s64			ddco_duration_ns;
+	s32			ddco_scaled_ppm;
+	bool			ddco_correction;
+	/* set on unregister, the timers must not be armed again */
+	bool			shutdown;
+	/* set while a TOD write sleeps with the device lock dropped */
+	bool			tod_busy;
+	struct completion	tod_idle;
 	u8			output_mask;
 	/* last input trigger for extts */
 	u8			tod_trigger;
@@ -81,7 +102,8 @@ struct idt82p33 {
 	/* Overhead calculation for adjtime */
 	ktime_t			start_time;
 	int			calculate_overhead_flag;
-	s64			tod_write_overhead_ns;
+	struct bus_latency	tod_write_latency;
+	struct dentry		*debugfs;
 };
 
 #endif /* PTP_IDT82P33_H */
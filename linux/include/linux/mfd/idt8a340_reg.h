@@ -162,6 +162,22 @@
 #define DPLLSYS_FILTER_STATUS             0x0084
 #define USER_GPIO0_TO_7_STATUS            0x008a
 #define USER_GPIO8_TO_15_STATUS           0x008b
+#define DPLL0_PHASE_STATUS                0x008c
+#define DPLL1_PHASE_STATUS                0x0090
+#define DPLL2_PHASE_STATUS                0x0094
+#define DPLL3_PHASE_STATUS                0x0098
+#define DPLL4_PHASE_STATUS                0x009c
+#define DPLL5_PHASE_STATUS                0x00a0
+#define DPLL6_PHASE_STATUS                0x00a4
+#define DPLL7_PHASE_STATUS                0x00a8
+#define OUTPUT_TDC0_STATUS                0x00c8
+#define OUTPUT_TDC1_STATUS                0x00c9
+#define OUTPUT_TDC2_STATUS                0x00ca
+#define OUTPUT_TDC3_STATUS                0x00cb
+#define OUTPUT_TDC0_MEASUREMENT           0x00cc
+#define OUTPUT_TDC1_MEASUREMENT           0x00d4
+#define OUTPUT_TDC2_MEASUREMENT           0x00dc
+#define OUTPUT_TDC3_MEASUREMENT           0x00e4
 
 #define GPIO_USER_CONTROL                 0x2010c160
 #define GPIO0_TO_7_OUT                    0x0000
@@ -728,6 +744,21 @@
 #define IN_MON_STATUS_LOS_SHIFT       (0)
 #define IN_MON_STATUS_NO_ACT_SHIFT    (1)
 #define IN_MON_STATUS_FFO_LIMIT_SHIFT (2)
+#define IN_MON_STATUS_LOS_STICKY_SHIFT       (4)
+#define IN_MON_STATUS_NO_ACT_STICKY_SHIFT    (5)
+#define IN_MON_STATUS_FFO_LIMIT_STICKY_SHIFT (6)
+
+/* Bit definitions for the STICKY_STATUS_CLEAR register */
+#define STICKY_STATUS_CLEAR_ALL       BIT(0)
+
+/* DPLLn_PHASE_STATUS: 32-bit two's complement phase in DPLL_PHASE_STATUS_PS */
+#define DPLL_PHASE_STATUS_PS          (50)
+
+/* Bit definitions for the OUTPUT_TDCn_STATUS registers */
+#define OUTPUT_TDC_MEAS_VALID         BIT(0)
+
+/* OUTPUT_TDCn_MEASUREMENT: 48-bit two's complement phase in picosecond */
+#define OUTPUT_TDC_MEAS_LEN           (6)
 
 #define DEFAULT_PRIORITY_GROUP (0)
 #define MAX_PRIORITY_GROUP     (3)
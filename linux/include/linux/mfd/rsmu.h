@@ -8,6 +8,8 @@
 #ifndef __LINUX_MFD_RSMU_H
 #define __LINUX_MFD_RSMU_H
 
+#include <linux/string.h>
+
 #define RSMU_MAX_WRITE_COUNT	(255)
 #define RSMU_MAX_READ_COUNT	(255)
 
@@ -18,16 +20,25 @@ enum rsmu_type {
 	RSMU_FC3	= 0x38312,
 };
 
+#define RSMU_TXN_MAX_OPS	(32)
+#define RSMU_TXN_MAX_DATA	(256)
+
+struct rsmu_txn;
+
 /**
  *
  * struct rsmu_ddata - device data structure for sub devices.
  *
- * @dev:    i2c/spi device.
- * @regmap: i2c/spi bus access.
- * @lock:   mutex used by sub devices to make sure a series of
- *          bus access requests are not interrupted.
- * @type:   RSMU device type.
- * @page:   i2c/spi bus driver internal use only.
+ * @dev:        i2c/spi device.
+ * @regmap:     i2c/spi bus access.
+ * @lock:       mutex used by sub devices to make sure a series of
+ *              bus access requests are not interrupted.
+ * @type:       RSMU device type.
+ * @page:       i2c/spi bus driver internal use only.
+ * @page_mask:  register address bits selecting the bus page, 0 if flat.
+ * @txn_queue:  queue one access on a transaction, see rsmu_txn_read().
+ * @txn_commit: run a transaction, see rsmu_txn_commit().
+ * @txn_xfer:   i2c/spi bus driver internal use only.
  */
 struct rsmu_ddata {
 	struct device *dev;
@@ -35,5 +46,103 @@ struct rsmu_ddata {
 	struct mutex lock;
 	enum rsmu_type type;
 	u32 page;
+	u32 page_mask;
+	int (*txn_queue)(struct rsmu_txn *txn, u32 addr, u8 *buf, u16 len,
+			 bool read);
+	int (*txn_commit)(struct rsmu_txn *txn);
+	int (*txn_xfer)(struct rsmu_ddata *rsmu, struct rsmu_txn *txn);
+};
+
+/**
+ * struct rsmu_txn_op - one bus access of a transaction.
+ *
+ * @addr:   register address.
+ * @len:    number of bytes.
+ * @offset: position of the data in &rsmu_txn.data.
+ * @read:   true for a read, false for a write.
+ */
+struct rsmu_txn_op {
+	u32 addr;
+	u16 len;
+	u16 offset;
+	bool read;
+};
+
+/**
+ * struct rsmu_txn_dst - where read data is copied on commit.
+ *
+ * @buf:    caller buffer.
+ * @offset: position of the data in &rsmu_txn.data.
+ * @len:    number of bytes.
+ */
+struct rsmu_txn_dst {
+	u8 *buf;
+	u16 offset;
+	u16 len;
 };
+
+/**
+ * struct rsmu_txn - a batch of register accesses run as one bus transfer.
+ *
+ * Accesses are kept sorted by bus page, in queue order within a page, and
+ * contiguous accesses of the same direction are merged. Nothing is moved
+ * across rsmu_txn_barrier(). The first error is latched and returned by
+ * rsmu_txn_commit(). Too big for the stack, so allocate it.
+ *
+ * @rsmu:      device the transaction runs on.
+ * @err:       first error hit while queueing.
+ * @n_ops:     number of entries in @ops.
+ * @n_dst:     number of entries in @dst.
+ * @seg_start: first op that later accesses may be sorted in front of.
+ * @data_len:  bytes used in @data.
+ * @ops:       bus accesses, in execution order.
+ * @dst:       read destinations.
+ * @data:      write data and read results, in @ops order.
+ */
+struct rsmu_txn {
+	struct rsmu_ddata *rsmu;
+	int err;
+	u16 n_ops;
+	u16 n_dst;
+	u16 seg_start;
+	u16 data_len;
+	struct rsmu_txn_op ops[RSMU_TXN_MAX_OPS];
+	struct rsmu_txn_dst dst[RSMU_TXN_MAX_OPS];
+	u8 data[RSMU_TXN_MAX_DATA];
+};
+
+static inline void rsmu_txn_init(struct rsmu_txn *txn, struct rsmu_ddata *rsmu)
+{
+	memset(txn, 0, sizeof(*txn));
+	txn->rsmu = rsmu;
+}
+
+/* @buf is filled in by rsmu_txn_commit() */
+static inline int rsmu_txn_read(struct rsmu_txn *txn, u32 addr, u8 *buf,
+				u16 len)
+{
+	return txn->rsmu->txn_queue(txn, addr, buf, len, true);
+}
+
+/* @buf is copied, so it may be reused straight away */
+static inline int rsmu_txn_write(struct rsmu_txn *txn, u32 addr,
+				 const u8 *buf, u16 len)
+{
+	return txn->rsmu->txn_queue(txn, addr, (u8 *)buf, len, false);
+}
+
+/* Accesses queued after this point run after all those queued before it */
+static inline void rsmu_txn_barrier(struct rsmu_txn *txn)
+{
+	txn->seg_start = txn->n_ops;
+}
+
+/*
+ * Run the queued accesses with the caller holding &rsmu_ddata.lock, then
+ * empty the transaction for reuse.
+ */
+static inline int rsmu_txn_commit(struct rsmu_txn *txn)
+{
+	return txn->rsmu->txn_commit(txn);
+}
 #endif /*  __LINUX_MFD_RSMU_H */
@@ -85,12 +85,364 @@ struct rsmu_reference_monitor_status
 	struct rsmu_reference_monitor_status_alarms alarms;
 };
 
+#define RSMU_REG_RWV_MAX_SEGS 64
+#define RSMU_REG_RWV_MAX_BYTES (64 * 1024)
+
+/* One register range of RSMU_REG_READV/WRITEV, buf is a user pointer */
+struct rsmu_reg_seg {
+	__u64 buf;
+	__u32 offset;
+	__u32 len;
+};
+
+/*
+ * Read/write num_segs register ranges, segs is a pointer to
+ * struct rsmu_reg_seg[]. The ranges add up to RSMU_REG_RWV_MAX_BYTES.
+ */
+struct rsmu_reg_rwv {
+	__u64 segs;
+	__u32 num_segs;
+	__u32 reserved;
+};
+
 /* Get a TDC single-shot measurement in nanosecond */
 struct rsmu_get_tdc_meas {
 	bool continuous;
 	__s64 offset;
 };
 
+/* One TDC FIFO entry. seq counts the entries read from the FIFO, from 1 */
+struct rsmu_tdc_meas_sample {
+	__s64 offset;
+	__u32 seq;
+	__u32 reserved;
+};
+
+/* The FIFO was full, so measurements were lost before these samples */
+#define RSMU_TDC_MEAS_OVERRUN		(1 << 0)
+
+/*
+ * Up to max_samples continuous TDC measurements in nanosecond, oldest
+ * first. max_samples is set by the caller, the rest by the driver.
+ */
+struct rsmu_tdc_meas_batch {
+	__u32 max_samples;
+	__u32 num_samples;
+	__u32 flags;
+	__u32 reserved;
+	struct rsmu_tdc_meas_sample samples[TDC_FIFO_SIZE];
+};
+
+/* The stream ring was full, so samples were lost before this one */
+#define RSMU_TDC_STREAM_DROPPED		(1 << 1)
+
+/*
+ * One streamed TDC measurement in nanosecond, as read() from a streaming
+ * file. timestamp is CLOCK_MONOTONIC_RAW in nanosecond when the sample was
+ * drained from the FIFO, seq is as in struct rsmu_tdc_meas_sample and
+ * flags has RSMU_TDC_MEAS_OVERRUN and RSMU_TDC_STREAM_DROPPED.
+ */
+struct rsmu_tdc_sample {
+	__u64 timestamp;
+	__s64 offset;
+	__u32 seq;
+	__u32 flags;
+};
+
+/*
+ * Start (enable != 0) or stop TDC streaming on this file. The rest is set
+ * by the driver: ring_len is the ring size in samples and the counters,
+ * since streaming started, are the samples drained from the FIFO, those
+ * dropped because the ring was full and the times the FIFO was found full.
+ */
+struct rsmu_tdc_stream {
+	__u32 enable;
+	__u32 ring_len;
+	__u64 samples;
+	__u64 dropped;
+	__u64 overruns;
+};
+
+#define RSMU_FAILOVER_MAX_CANDIDATES	8
+
+/*
+ * Reference failover policy of a dpll, run by the driver on every status
+ * sample. The candidates (clock indexes, most preferred first) without any
+ * of the alarm_mask RSMU_ALARM_* bits are programmed as the dpll priorities
+ * in that order whenever that list changes, also switching back once a
+ * preferred candidate recovers. The priorities are left alone while no
+ * candidate qualifies. Every change queues an RSMU_EVENT_FAILOVER event.
+ */
+struct rsmu_failover_policy {
+	__u8 dpll;
+	__u8 enable;
+	__u8 num_candidates;
+	__u8 reserved;
+	__u32 alarm_mask;
+	__u8 candidates[RSMU_FAILOVER_MAX_CANDIDATES];
+};
+
+#define RSMU_FFO_HISTORY_LEN		256
+
+/* Weighting of struct rsmu_holdover_history */
+#define RSMU_HISTORY_UNIFORM		0
+#define RSMU_HISTORY_EXPONENTIAL	1
+
+/*
+ * FFO history of a dpll, recorded by the driver from the status sampler
+ * while the dpll is locked. Every decimation samples are averaged into one
+ * entry and the newest window entries (1 to RSMU_FFO_HISTORY_LEN) are
+ * averaged either uniformly or, for RSMU_HISTORY_EXPONENTIAL, with weights
+ * decaying by 2^-weight_shift (1 to 8) per entry from the newest. With
+ * preload set (82P33xxx only), RSMU_SET_HOLDOVER_MODE writes that average
+ * to the holdover frequency of the dpll before entering holdover and selects
+ * manual holdover until it leaves holdover. num_entries and ffo, the
+ * average in ppqt, are set by the driver. The history is kept as long as
+ * enable and decimation do not change.
+ */
+struct rsmu_holdover_history {
+	__u8 dpll;
+	__u8 enable;
+	__u8 preload;
+	__u8 weighting;
+	__u8 weight_shift;
+	__u8 reserved[3];
+	__u16 window;
+	__u16 decimation;
+	__u32 num_entries;
+	__s64 ffo;
+};
+
+#define RSMU_MAX_OUTPUT_TDCS		4
+
+/*
+ * Latest phase measured by each output TDC in picosecond, phase[n] is
+ * valid if bit n of valid is set. timestamp is as in struct
+ * rsmu_status_snapshot.
+ */
+struct rsmu_output_tdc_meas {
+	__u64 timestamp;
+	__s64 phase[RSMU_MAX_OUTPUT_TDCS];
+	__u32 valid;
+	__u32 reserved;
+};
+
+#define RSMU_TDC_HIST_BINS		32
+#define RSMU_TDC_STATS_FRAC_BITS	16
+
+/* Flags of struct rsmu_tdc_stats */
+#define RSMU_TDC_STATS_RESET		(1 << 0)
+#define RSMU_TDC_STATS_STOP		(1 << 1)
+
+/*
+ * Statistics of the continuous TDC measurements since the statistics were
+ * started or reset, at time since. mean is in nanosecond with
+ * RSMU_TDC_STATS_FRAC_BITS fractional bits, m2 is the sum of the squared
+ * deviations from the mean in nanosecond squared (the variance is
+ * m2 / (count - 1)) and min and max are in nanosecond. hist[n] counts the
+ * offsets from hist_center_ns + (n - RSMU_TDC_HIST_BINS / 2) * hist_bin_ns
+ * up to one hist_bin_ns more, the first and last bins also count anything
+ * beyond them. flags, and hist_bin_ns with hist_center_ns when hist_bin_ns
+ * is not 0, are set by the caller and applied when the statistics start
+ * or are reset. The rest is set by the driver.
+ */
+struct rsmu_tdc_stats {
+	__u32 flags;
+	__u32 hist_bin_ns;
+	__s64 hist_center_ns;
+	__u64 since;
+	__u64 timestamp;
+	__u64 count;
+	__s64 mean;
+	__u64 m2;
+	__s64 min;
+	__s64 max;
+	__u32 hist[RSMU_TDC_HIST_BINS];
+};
+
+#define RSMU_MAX_DPLLS 9
+#define RSMU_MAX_INPUTS 16
+
+/*
+ * Status of every DPLL and input, decoded as for RSMU_GET_STATE,
+ * RSMU_GET_CURRENT_CLOCK_INDEX, RSMU_GET_REFERENCE_MONITOR_STATUS and
+ * RSMU_GET_FFO. Entries past num_dplls and num_inputs are unused and bit n
+ * of ffo_valid is set if ffo[n] is supported. timestamp is CLOCK_MONOTONIC_RAW
+ * in nanosecond, taken half way through reading the device.
+ */
+struct rsmu_status_snapshot {
+	__u64 timestamp;
+	__s64 ffo[RSMU_MAX_DPLLS];
+	__u32 ffo_valid;
+	__u8 num_dplls;
+	__u8 num_inputs;
+	__u8 state[RSMU_MAX_DPLLS];
+	__s8 clock_index[RSMU_MAX_DPLLS];
+	struct rsmu_reference_monitor_status_alarms alarms[RSMU_MAX_INPUTS];
+};
+
+/* Flags of struct rsmu_dpll_phase */
+#define RSMU_PHASE_VALID		(1 << 0)
+#define RSMU_PHASE_QUALIFIED		(1 << 1)
+#define RSMU_PHASE_MEASUREMENT		(1 << 2)
+
+/*
+ * Phase of the reference of a DPLL relative to the DPLL, in picosecond.
+ * RSMU_PHASE_VALID is set if the DPLL has a reference (clock_index >= 0),
+ * RSMU_PHASE_QUALIFIED if that reference has no monitor alarm and
+ * RSMU_PHASE_MEASUREMENT if the DPLL is in phase measurement mode, where
+ * it only measures its reference against its feedback.
+ */
+struct rsmu_dpll_phase {
+	__s64 phase;
+	__s8 clock_index;
+	__u8 flags;
+	__u8 reserved[6];
+};
+
+/*
+ * Phase of every DPLL's reference, entries past num_dplls are unused.
+ * timestamp is as in struct rsmu_status_snapshot.
+ */
+struct rsmu_phase_table {
+	__u64 timestamp;
+	__u8 num_dplls;
+	__u8 reserved[7];
+	struct rsmu_dpll_phase dpll[RSMU_MAX_DPLLS];
+};
+
+/*
+ * Status page, mapped read-only by mmap() of one page at offset 0 and
+ * refreshed by the driver every period_ms while it is mapped. seq is odd
+ * while the driver updates the page and goes up by 2 on every refresh, so
+ * a reader retries until it sees the same even seq around its copy:
+ *
+ *	do {
+ *		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+ *		snapshot = page->snapshot;
+ *		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *	} while ((seq & 1) || seq != __atomic_load_n(&page->seq, __ATOMIC_RELAXED));
+ *
+ * err is the result of the last refresh, which leaves snapshot untouched
+ * on failure. period_ms is 0 once the driver stopped refreshing the page.
+ * phase is refreshed along with snapshot when the status_phase module
+ * parameter is set, its num_dplls is 0 otherwise or if reading it failed.
+ */
+struct rsmu_status_page {
+	__u32 seq;
+	__s32 err;
+	__u32 period_ms;
+	__u32 reserved;
+	struct rsmu_status_snapshot snapshot;
+	struct rsmu_phase_table phase;
+};
+
+/* Event types, see RSMU_SET_EVENT_MASK */
+#define RSMU_EVENT_DPLL_STATE		(1 << 0)
+#define RSMU_EVENT_REF_SWITCH		(1 << 1)
+#define RSMU_EVENT_MONITOR_ALARM	(1 << 2)
+#define RSMU_EVENT_TDC_DATA		(1 << 3)
+#define RSMU_EVENT_FAILOVER		(1 << 4)
+/* Not subscribable: events were dropped because the queue was full */
+#define RSMU_EVENT_OVERFLOW		(1 << 31)
+
+/* Alarm bits of RSMU_EVENT_MONITOR_ALARM values */
+#define RSMU_ALARM_LOS			(1 << 0)
+#define RSMU_ALARM_NO_ACTIVITY		(1 << 1)
+#define RSMU_ALARM_FREQUENCY_OFFSET	(1 << 2)
+
+#define RSMU_NUM_ALARMS			3
+
+/*
+ * Alarms latched since the previous RSMU_GET_STICKY_ALARMS, which clears
+ * them. alarms[n] has the RSMU_ALARM_* bits raised by input n, even for a
+ * moment between two samples where the device latches them in hardware.
+ * count[n][b] is the number of times alarm bit b of input n was asserted
+ * since the first RSMU_GET_STICKY_ALARMS, it is never cleared and wraps.
+ * since and timestamp are the CLOCK_MONOTONIC_RAW time in nanosecond of
+ * the previous and this call.
+ */
+struct rsmu_sticky_alarms {
+	__u64 since;
+	__u64 timestamp;
+	__u32 count[RSMU_MAX_INPUTS][RSMU_NUM_ALARMS];
+	__u8 num_inputs;
+	__u8 alarms[RSMU_MAX_INPUTS];
+	__u8 reserved[7];
+};
+
+/*
+ * Events to queue on this open file: events is a mask of RSMU_EVENT_*,
+ * bit n of dpll_mask selects the DPLL n state and reference switch events
+ * and bit n of input_mask selects the input n alarm events.
+ */
+struct rsmu_event_mask {
+	__u32 events;
+	__u32 dpll_mask;
+	__u32 input_mask;
+};
+
+/*
+ * Record returned by read(). timestamp is the CLOCK_MONOTONIC_RAW time in
+ * nanosecond of the status read that saw the change. index is the DPLL
+ * or the input, old_value and new_value are the rsmu_class_state for
+ * RSMU_EVENT_DPLL_STATE, the clock index for RSMU_EVENT_REF_SWITCH,
+ * RSMU_ALARM_* bits for RSMU_EVENT_MONITOR_ALARM and the first programmed
+ * candidate (-1 for none) for RSMU_EVENT_FAILOVER.
+ */
+struct rsmu_event {
+	__u64 timestamp;
+	__u32 type;
+	__u8 index;
+	__s8 old_value;
+	__s8 new_value;
+	__u8 reserved;
+};
+
+/* Sub-operations of RSMU_BATCH */
+enum rsmu_batch_op_code {
+	RSMU_BATCH_GET_STATE = 1,
+	RSMU_BATCH_GET_FFO,
+	RSMU_BATCH_GET_CURRENT_CLOCK_INDEX,
+	RSMU_BATCH_GET_REFERENCE_MONITOR_STATUS,
+};
+
+#define RSMU_BATCH_MAX_OPS 64
+
+/*
+ * RSMU_BATCH_GET_FFO payload. Unlike struct rsmu_get_ffo, ffo is at the
+ * same offset for 32-bit and 64-bit user space.
+ */
+struct rsmu_batch_ffo {
+	__u8 dpll;
+	__u8 reserved[7];
+	__s64 ffo;
+};
+
+/*
+ * One sub-operation of RSMU_BATCH. The arguments and the result are in the
+ * union member matching op, err is set to 0 or a negative errno.
+ */
+struct rsmu_batch_op {
+	__u32 op;
+	__s32 err;
+	union {
+		struct rsmu_get_state state;
+		struct rsmu_batch_ffo ffo;
+		struct rsmu_current_clock_index clock_index;
+		struct rsmu_reference_monitor_status ref_mon_status;
+		/* Same layout for 32-bit and 64-bit user space */
+		__u8 reserved[16];
+	};
+};
+
+/* Run num_ops sub-operations, ops is a pointer to struct rsmu_batch_op[] */
+struct rsmu_batch {
+	__u64 ops;
+	__u32 num_ops;
+	__u32 reserved;
+};
+
 /*
  * RSMU IOCTL List
  */
@@ -172,13 +524,152 @@ struct rsmu_get_tdc_meas {
 
 /**
  * @Description
- * ioctl to get a one-shot tdc measurement (FC3W only).
+ * ioctl to get a one-shot tdc measurement. On ClockMatrix, this is the
+ * phase measured by output TDC 0, which keeps measuring when continuous.
  *
  * @Parameters
  * pointer to struct rsmu_get_tdc_meas that contains a one-shot tdc measurement
  */
 #define RSMU_GET_TDC_MEAS  _IOR(RSMU_MAGIC, 9, struct rsmu_get_tdc_meas)
 
+/**
+ * @Description
+ * ioctl to run up to RSMU_BATCH_MAX_OPS get operations in one call, with
+ * the device locked once for the whole batch. A failing sub-operation
+ * does not stop the others; its error is returned in its own entry.
+ *
+ * @Parameters
+ * pointer to struct rsmu_batch that points to an array of struct rsmu_batch_op
+ */
+#define RSMU_BATCH  _IOW(RSMU_MAGIC, 10, struct rsmu_batch)
+
+/**
+ * @Description
+ * ioctl to get the status of all SMU dplls and inputs in one call. On
+ * ClockMatrix, this is a single burst read of the whole status block.
+ *
+ * @Parameters
+ * pointer to struct rsmu_status_snapshot that contains the device status
+ */
+#define RSMU_GET_STATUS_SNAPSHOT  _IOR(RSMU_MAGIC, 11, struct rsmu_status_snapshot)
+
+/**
+ * @Description
+ * ioctl to select the events queued on this open file, to be waited for
+ * with poll() and fetched with read() as struct rsmu_event records. The
+ * device status is sampled every status_period_ms while any file has
+ * events selected, so call RSMU_GET_STATUS_SNAPSHOT after subscribing
+ * for the starting state.
+ *
+ * @Parameters
+ * pointer to struct rsmu_event_mask that contains the events to queue
+ */
+#define RSMU_SET_EVENT_MASK  _IOW(RSMU_MAGIC, 12, struct rsmu_event_mask)
+
+/**
+ * @Description
+ * ioctl to read and clear the alarms latched for every input. The first
+ * call starts the alarm accumulator, which then samples the inputs every
+ * status_period_ms and also keeps per-input alarm assertion counts, until
+ * the file that started it is closed. Meanwhile that file owns the sticky
+ * alarms of the device, which each sample reads and clears, and the call
+ * fails with EBUSY on other files.
+ *
+ * @Parameters
+ * pointer to struct rsmu_sticky_alarms that contains the latched alarms
+ */
+#define RSMU_GET_STICKY_ALARMS  _IOR(RSMU_MAGIC, 13, struct rsmu_sticky_alarms)
+
+/**
+ * @Description
+ * ioctl to drain the TDC FIFO in continuous measurement mode (FC3W only).
+ * Waits for a first measurement like RSMU_GET_TDC_MEAS, then returns it
+ * with whatever else is queued, up to max_samples.
+ *
+ * @Parameters
+ * pointer to struct rsmu_tdc_meas_batch that contains the measurements
+ */
+#define RSMU_GET_TDC_MEAS_BATCH  _IOWR(RSMU_MAGIC, 14, struct rsmu_tdc_meas_batch)
+
+/**
+ * @Description
+ * ioctl to stream continuous TDC measurements (FC3W and ClockMatrix). The
+ * driver drains the TDC FIFO before it fills into a ring of tdc_ring_len
+ * samples, read() as struct rsmu_tdc_sample records from this file, which
+ * poll() reports readable when samples are queued. ClockMatrix has no FIFO:
+ * the latest result of output TDC 0 is sampled every 100 ms instead. A
+ * streaming file cannot select events, and RSMU_GET_TDC_MEAS* fail with
+ * EBUSY while a stream runs.
+ *
+ * @Parameters
+ * pointer to struct rsmu_tdc_stream that contains the stream counters
+ */
+#define RSMU_SET_TDC_STREAM  _IOWR(RSMU_MAGIC, 15, struct rsmu_tdc_stream)
+
+/**
+ * @Description
+ * ioctl to read TDC statistics (FC3W only), then reset them with
+ * RSMU_TDC_STATS_RESET or stop them with RSMU_TDC_STATS_STOP. The first
+ * call starts them: the driver then keeps the TDC in continuous mode and
+ * drains its FIFO in the background, and RSMU_GET_TDC_MEAS* fail with
+ * EBUSY until the statistics are stopped. Once neither the statistics nor
+ * a stream are left, the TDC goes back to its previous measurement mode.
+ *
+ * @Parameters
+ * pointer to struct rsmu_tdc_stats that contains the statistics
+ */
+#define RSMU_GET_TDC_STATS  _IOWR(RSMU_MAGIC, 16, struct rsmu_tdc_stats)
+
+/**
+ * @Description
+ * ioctl to get the latest phase of all output TDCs (ClockMatrix only) in
+ * one burst read. RSMU_SET_OUTPUT_TDC_GO starts a TDC measuring.
+ *
+ * @Parameters
+ * pointer to struct rsmu_output_tdc_meas that contains the phases
+ */
+#define RSMU_GET_OUTPUT_TDC_MEAS  _IOR(RSMU_MAGIC, 17, struct rsmu_output_tdc_meas)
+
+/**
+ * @Description
+ * ioctl to get the reference phase of every dpll in one call, to rank the
+ * references measured by dplls in phase measurement mode.
+ *
+ * @Parameters
+ * pointer to struct rsmu_phase_table that contains the phases
+ */
+#define RSMU_GET_PHASE_TABLE  _IOR(RSMU_MAGIC, 18, struct rsmu_phase_table)
+
+/**
+ * @Description
+ * ioctl to set or clear the reference failover policy of a dpll. Policies
+ * are run every status_period_ms, so a failed reference is replaced within
+ * one sample, and are kept until cleared.
+ *
+ * @Parameters
+ * pointer to struct rsmu_failover_policy that contains the policy
+ */
+#define RSMU_SET_FAILOVER_POLICY  _IOW(RSMU_MAGIC, 19, struct rsmu_failover_policy)
+
+/**
+ * @Description
+ * ioctl to configure the FFO history of a dpll and read its average.
+ * Entering holdover with RSMU_SET_HOLDOVER_MODE preloads the average if
+ * requested, from at least one entry, and leaves the device to its own
+ * history otherwise.
+ *
+ * @Parameters
+ * pointer to struct rsmu_holdover_history that contains the configuration
+ */
+#define RSMU_SET_HOLDOVER_HISTORY  _IOWR(RSMU_MAGIC, 20, struct rsmu_holdover_history)
+
 #define RSMU_REG_READ   _IOR(RSMU_MAGIC, 100, struct rsmu_reg_rw)
 #define RSMU_REG_WRITE  _IOR(RSMU_MAGIC, 101, struct rsmu_reg_rw)
+
+/*
+ * Read/write a list of register ranges of any length, in list order and
+ * with the device locked once for the whole list.
+ */
+#define RSMU_REG_READV   _IOW(RSMU_MAGIC, 102, struct rsmu_reg_rwv)
+#define RSMU_REG_WRITEV  _IOW(RSMU_MAGIC, 103, struct rsmu_reg_rwv)
 #endif /* __UAPI_LINUX_RSMU_CDEV_H */